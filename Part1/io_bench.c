@@ -0,0 +1,295 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/*
+ * The open/write/close pattern of part1.c, scaled up to N records, done four
+ * ways: one write()/read() per record, writev()/readv() over a batch of
+ * records, io_uring with one io_uring_enter() per batch, and io_uring with
+ * the file and buffer registered up front. Every syscall in the timed
+ * region goes through SYS() so we can report syscalls per record next to
+ * throughput. io_uring is driven through the raw syscalls, no liburing.
+ *
+ * usage: io_bench [-n records] [-s record_size] [-b batch] [-f file]
+ */
+
+static long nsys;
+#define SYS(call) (nsys++, (call))
+
+static long records = 100000;
+static size_t size = 22;                // part1's "Hello, System Call 1!\n"
+static unsigned int batch = 64;
+static const char *path = "io_bench.tmp";
+static char *data;                      // batch * size bytes, record i uses slot i % batch
+
+static double now_s(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void die(const char *what) {
+    perror(what);
+    unlink(path);
+    exit(1);
+}
+
+static int open_file(int writing) {
+    int fd = writing ? SYS(open(path, O_CREAT | O_WRONLY | O_TRUNC, 0644)) : SYS(open(path, O_RDONLY));
+
+    if (fd < 0)
+        die("open");
+    return fd;
+}
+
+static void sync_io(int writing) {
+    int fd = open_file(writing);
+    long i;
+
+    for (i = 0; i < records; i++) {
+        char *slot = data + (i % batch) * size;
+        ssize_t n = writing ? SYS(write(fd, slot, size)) : SYS(read(fd, slot, size));
+
+        if (n != (ssize_t)size)
+            die(writing ? "write" : "read");
+    }
+    SYS(close(fd));
+}
+
+static void vectored_io(int writing) {
+    struct iovec *iov = calloc(batch, sizeof(*iov));
+    int fd = open_file(writing);
+    unsigned int j;
+    long i, k;
+
+    for (j = 0; j < batch; j++) {
+        iov[j].iov_base = data + j * size;
+        iov[j].iov_len = size;
+    }
+    for (i = 0; i < records; i += k) {
+        ssize_t n;
+
+        k = records - i < batch ? records - i : batch;
+        n = writing ? SYS(writev(fd, iov, k)) : SYS(readv(fd, iov, k));
+        if (n != (ssize_t)(k * size))
+            die(writing ? "writev" : "readv");
+    }
+    SYS(close(fd));
+    free(iov);
+}
+
+struct ring {
+    int fd;
+    unsigned int *sq_tail, *sq_mask, *sq_array;
+    unsigned int *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_len, cq_len, sqes_len;
+};
+
+static int ring_setup(struct ring *r, unsigned int entries) {
+    struct io_uring_params p;
+
+    memset(&p, 0, sizeof(p));
+    memset(r, 0, sizeof(*r));
+    r->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0)
+        return -1;
+
+    r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        r->sq_len = r->cq_len = r->sq_len > r->cq_len ? r->sq_len : r->cq_len;
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    r->sq_ptr = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED)
+        return -1;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ptr = r->sq_ptr;
+    } else {
+        r->cq_ptr = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_ptr == MAP_FAILED)
+            return -1;
+    }
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
+        return -1;
+
+    r->sq_tail = (unsigned int *)((char *)r->sq_ptr + p.sq_off.tail);
+    r->sq_mask = (unsigned int *)((char *)r->sq_ptr + p.sq_off.ring_mask);
+    r->sq_array = (unsigned int *)((char *)r->sq_ptr + p.sq_off.array);
+    r->cq_head = (unsigned int *)((char *)r->cq_ptr + p.cq_off.head);
+    r->cq_tail = (unsigned int *)((char *)r->cq_ptr + p.cq_off.tail);
+    r->cq_mask = (unsigned int *)((char *)r->cq_ptr + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)((char *)r->cq_ptr + p.cq_off.cqes);
+    return 0;
+}
+
+static void ring_teardown(struct ring *r) {
+    munmap(r->sqes, r->sqes_len);
+    if (r->cq_ptr != r->sq_ptr)
+        munmap(r->cq_ptr, r->cq_len);
+    munmap(r->sq_ptr, r->sq_len);
+    close(r->fd);
+}
+
+// Queue k reads or writes of records i..i+k-1, submit them and wait for all
+// of them with a single io_uring_enter.
+static void ring_batch(struct ring *r, int fd, int fixed, int writing, long i, unsigned int k) {
+    unsigned int tail = *r->sq_tail, head, j;
+
+    for (j = 0; j < k; j++) {
+        unsigned int idx = tail & *r->sq_mask;
+        struct io_uring_sqe *sqe = &r->sqes[idx];
+
+        memset(sqe, 0, sizeof(*sqe));
+        if (fixed) {
+            sqe->opcode = writing ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+            sqe->flags = IOSQE_FIXED_FILE;
+            sqe->fd = 0;                // index into the registered file table
+            sqe->buf_index = 0;         // the whole data buffer is registered buffer 0
+        } else {
+            sqe->opcode = writing ? IORING_OP_WRITE : IORING_OP_READ;
+            sqe->fd = fd;
+        }
+        sqe->addr = (unsigned long)(data + ((i + j) % batch) * size);
+        sqe->len = size;
+        sqe->off = (i + j) * size;
+        sqe->user_data = i + j;
+        r->sq_array[idx] = idx;
+        tail++;
+    }
+    __atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+
+    if (SYS(syscall(__NR_io_uring_enter, r->fd, k, k, IORING_ENTER_GETEVENTS, NULL, 0)) < 0)
+        die("io_uring_enter");
+
+    head = *r->cq_head;
+    for (j = 0; j < k; j++, head++) {
+        struct io_uring_cqe *cqe;
+
+        while (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+            ;
+        cqe = &r->cqes[head & *r->cq_mask];
+        if (cqe->res != (int)size) {
+            errno = cqe->res < 0 ? -cqe->res : EIO;
+            die(writing ? "io_uring write" : "io_uring read");
+        }
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static struct ring ring;
+
+static void uring_io(int writing, int fixed) {
+    int fd = open_file(writing);
+    struct iovec buf = { data, batch * size };
+    long i;
+    unsigned int k;
+
+    if (fixed) {
+        if (SYS(syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_FILES, &fd, 1)) < 0)
+            die("IORING_REGISTER_FILES");
+        if (SYS(syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_BUFFERS, &buf, 1)) < 0)
+            die("IORING_REGISTER_BUFFERS");
+    }
+
+    for (i = 0; i < records; i += k) {
+        k = records - i < batch ? records - i : batch;
+        ring_batch(&ring, fd, fixed, writing, i, k);
+    }
+
+    if (fixed) {
+        SYS(syscall(__NR_io_uring_register, ring.fd, IORING_UNREGISTER_BUFFERS, NULL, 0));
+        SYS(syscall(__NR_io_uring_register, ring.fd, IORING_UNREGISTER_FILES, NULL, 0));
+    }
+    SYS(close(fd));
+}
+
+static void uring_plain(int writing) { uring_io(writing, 0); }
+static void uring_fixed(int writing) { uring_io(writing, 1); }
+
+struct variant {
+    const char *name;
+    void (*run)(int writing);
+    int uring;
+};
+
+static const struct variant variants[] = {
+    { "sync", sync_io, 0 },
+    { "vectored", vectored_io, 0 },
+    { "io_uring", uring_plain, 1 },
+    { "io_uring_fixed", uring_fixed, 1 },
+};
+
+static void measure(const struct variant *v, int writing) {
+    double start, elapsed;
+
+    nsys = 0;
+    start = now_s();
+    v->run(writing);
+    elapsed = now_s() - start;
+
+    printf("%-15s %-5s %10ld %10.1f %12.0f %12.3f\n", v->name, writing ? "write" : "read", records,
+           records * size / elapsed / 1e6, records / elapsed, (double)nsys / records);
+}
+
+int main(int argc, char **argv) {
+    int have_uring;
+    size_t i;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:b:f:")) != -1) {
+        switch (opt) {
+        case 'n': records = atol(optarg); break;
+        case 's': size = atol(optarg); break;
+        case 'b': batch = atoi(optarg); break;
+        case 'f': path = optarg; break;
+        default:
+            fprintf(stderr, "usage: io_bench [-n records] [-s record_size] [-b batch] [-f file]\n");
+            return -1;
+        }
+    }
+    if (records < 1 || size < 1 || batch < 1 || batch > IOV_MAX) {
+        fprintf(stderr, "records, size and batch must be positive, batch at most %d\n", IOV_MAX);
+        return -1;
+    }
+
+    data = malloc(batch * size);
+    if (data == NULL)
+        die("malloc");
+    for (i = 0; i < batch * size; i++)
+        data[i] = 'a' + i % 26;
+
+    have_uring = ring_setup(&ring, batch) == 0;
+    if (!have_uring)
+        perror("io_uring_setup, skipping io_uring variants");
+
+    printf("%ld records of %zu bytes, batch %u\n", records, size, batch);
+    printf("%-15s %-5s %10s %10s %12s %12s\n", "variant", "phase", "records", "MB/s", "records/s", "syscalls/rec");
+    for (i = 0; i < sizeof(variants) / sizeof(variants[0]); i++) {
+        if (variants[i].uring && !have_uring)
+            continue;
+        measure(&variants[i], 1);
+        measure(&variants[i], 0);
+    }
+
+    if (have_uring)
+        ring_teardown(&ring);
+    unlink(path);
+    free(data);
+    return 0;
+}
@@ -0,0 +1,357 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <stddef.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <linux/audit.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <linux/ptrace.h>
+
+/*
+ * Count (and optionally time) selected syscalls of a command without
+ * stopping it on every syscall the way strace does. Before exec the child
+ * installs a seccomp filter that returns SECCOMP_RET_TRACE for the selected
+ * syscalls and SECCOMP_RET_ALLOW for everything else, so only the selected
+ * ones ever stop for the tracer.
+ *
+ * Filters are inherited by children, and a RET_TRACE with no tracer fails
+ * the syscall with ENOSYS, so forks, vforks and threads are always followed.
+ *
+ * With -t, each traced call is also stopped at syscall exit, giving its
+ * result and the time between the two stops as the tracer saw it. That
+ * time includes the ptrace round trips, so compare calls with each other
+ * rather than reading it as the bare kernel cost.
+ *
+ * usage: sctrace [-t] [-o file] -e syscall[,syscall...] command [args...]
+ */
+
+#if defined(__x86_64__)
+#define AUDIT_ARCH_NATIVE AUDIT_ARCH_X86_64
+#elif defined(__aarch64__)
+#define AUDIT_ARCH_NATIVE AUDIT_ARCH_AARCH64
+#elif defined(__i386__)
+#define AUDIT_ARCH_NATIVE AUDIT_ARCH_I386
+#else
+#error "set AUDIT_ARCH_NATIVE for this architecture"
+#endif
+
+#define MAX_SELECTED 64
+#define MAX_TRACEES 4096        // power of two, open-addressed by pid
+
+struct syscall_name {
+    const char *name;
+    int nr;
+};
+
+#define SC(n) { #n, SYS_##n },
+static const struct syscall_name names[] = {
+#ifdef SYS_open
+    SC(open)
+#endif
+#ifdef SYS_stat
+    SC(stat)
+#endif
+#ifdef SYS_fork
+    SC(fork)
+#endif
+#ifdef SYS_vfork
+    SC(vfork)
+#endif
+#ifdef SYS_access
+    SC(access)
+#endif
+#ifdef SYS_arch_prctl
+    SC(arch_prctl)
+#endif
+    SC(read) SC(write) SC(close) SC(fstat) SC(lseek) SC(mmap) SC(mprotect) SC(munmap) SC(brk)
+    SC(rt_sigaction) SC(rt_sigprocmask) SC(ioctl) SC(pread64) SC(pwrite64) SC(readv) SC(writev)
+    SC(sched_yield) SC(mremap) SC(madvise) SC(dup) SC(nanosleep) SC(getpid) SC(socket) SC(connect)
+    SC(sendto) SC(recvfrom) SC(clone) SC(execve) SC(exit) SC(wait4) SC(kill) SC(uname) SC(fcntl)
+    SC(fsync) SC(getcwd) SC(chdir) SC(unlinkat) SC(mkdirat) SC(renameat) SC(readlinkat)
+    SC(gettimeofday) SC(getuid) SC(getgid) SC(geteuid) SC(getegid) SC(getppid) SC(gettid) SC(futex)
+    SC(set_tid_address) SC(clock_gettime) SC(clock_nanosleep) SC(exit_group) SC(openat)
+    SC(newfstatat) SC(set_robust_list) SC(prlimit64) SC(getrandom) SC(statx) SC(rseq)
+    SC(io_uring_setup) SC(io_uring_enter) SC(execveat) SC(ppoll) SC(pselect6) SC(epoll_pwait)
+    { "start_elevator", 548 },
+    { "issue_request", 549 },
+    { "stop_elevator", 550 },
+    { "elevator_eta", 551 },
+};
+
+struct stat_entry {
+    const char *name;
+    int nr;
+    unsigned long calls;
+    unsigned long errors;
+    double seconds;
+};
+
+static struct stat_entry selected[MAX_SELECTED];
+static int nselected;
+
+struct tracee {
+    pid_t pid;                  // 0: free slot, -1: deleted
+    int in_call;                // index into selected, or -1
+    struct timespec entered;
+};
+
+static struct tracee tracees[MAX_TRACEES];
+
+static struct tracee *tracee_find(pid_t pid, int insert) {
+    unsigned int i, slot = (unsigned int)pid & (MAX_TRACEES - 1);
+    struct tracee *hole = NULL;
+
+    for (i = 0; i < MAX_TRACEES; i++, slot = (slot + 1) & (MAX_TRACEES - 1)) {
+        struct tracee *t = &tracees[slot];
+
+        if (t->pid == pid)
+            return t;
+        if (t->pid == -1 && hole == NULL)
+            hole = t;
+        if (t->pid == 0) {
+            if (hole == NULL)
+                hole = t;
+            break;
+        }
+    }
+    if (!insert || hole == NULL)
+        return NULL;
+    hole->pid = pid;
+    hole->in_call = -1;
+    return hole;
+}
+
+static int lookup(const char *name) {
+    char *end;
+    long nr = strtol(name, &end, 10);
+    size_t i;
+
+    if (*name && *end == '\0')
+        return nr;
+    for (i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+        if (strcmp(names[i].name, name) == 0)
+            return names[i].nr;
+    return -1;
+}
+
+static int parse_selection(char *list) {
+    char *tok;
+
+    for (tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) {
+        int nr = lookup(tok);
+
+        if (nr < 0) {
+            fprintf(stderr, "sctrace: unknown syscall '%s' (use the number)\n", tok);
+            return -1;
+        }
+        if (nselected == MAX_SELECTED) {
+            fprintf(stderr, "sctrace: at most %d syscalls\n", MAX_SELECTED);
+            return -1;
+        }
+        selected[nselected].name = strdup(tok);
+        selected[nselected].nr = nr;
+        nselected++;
+    }
+    return nselected ? 0 : -1;
+}
+
+// arch check, then one compare per selected syscall. RET_DATA carries the
+// index into selected[], which the tracer reads back with GETEVENTMSG.
+static int install_filter(void) {
+    struct sock_filter prog[4 + 2 * MAX_SELECTED + 1];
+    struct sock_fprog fprog;
+    int n = 0, i;
+
+    prog[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, arch));
+    prog[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, AUDIT_ARCH_NATIVE, 1, 0);
+    prog[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW);
+    prog[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, nr));
+    for (i = 0; i < nselected; i++) {
+        prog[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, selected[i].nr, 0, 1);
+        prog[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_TRACE | i);
+    }
+    prog[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW);
+
+    fprog.len = n;
+    fprog.filter = prog;
+    if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) < 0)
+        return -1;
+    return syscall(SYS_seccomp, SECCOMP_SET_MODE_FILTER, 0, &fprog);
+}
+
+static double elapsed(const struct timespec *a, const struct timespec *b) {
+    return (b->tv_sec - a->tv_sec) + (b->tv_nsec - a->tv_nsec) / 1e9;
+}
+
+static void report(FILE *out, int timing, double wall) {
+    double total = 0;
+    unsigned long calls = 0, errors = 0;
+    int i;
+
+    for (i = 0; i < nselected; i++) {
+        total += selected[i].seconds;
+        calls += selected[i].calls;
+        errors += selected[i].errors;
+    }
+
+    fprintf(out, "%% time     seconds  usecs/call     calls    errors syscall\n");
+    fprintf(out, "------ ----------- ----------- --------- --------- ----------------\n");
+    for (i = 0; i < nselected; i++) {
+        struct stat_entry *s = &selected[i];
+
+        if (timing)
+            fprintf(out, "%6.2f %11.6f %11.0f %9lu %9lu %s\n", total > 0 ? 100 * s->seconds / total : 0,
+                    s->seconds, s->calls ? 1e6 * s->seconds / s->calls : 0, s->calls, s->errors, s->name);
+        else
+            fprintf(out, "%6s %11s %11s %9lu %9s %s\n", "-", "-", "-", s->calls, "-", s->name);
+    }
+    fprintf(out, "------ ----------- ----------- --------- --------- ----------------\n");
+    if (timing)
+        fprintf(out, "100.00 %11.6f %11.0f %9lu %9lu total\n", total, calls ? 1e6 * total / calls : 0, calls, errors);
+    else
+        fprintf(out, "%6s %11s %11s %9lu %9s total\n", "-", "-", "-", calls, "-");
+    fprintf(out, "wall time %.6f s\n", wall);
+}
+
+int main(int argc, char **argv) {
+    const char *outpath = NULL;
+    struct timespec start, end;
+    int timing = 0, exit_code = 0;
+    pid_t child;
+    FILE *out = stderr;
+    int opt, status;
+
+    while ((opt = getopt(argc, argv, "+te:o:")) != -1) {
+        switch (opt) {
+        case 't': timing = 1; break;
+        case 'e':
+            if (parse_selection(optarg) < 0)
+                return 1;
+            break;
+        case 'o': outpath = optarg; break;
+        default:
+            goto usage;
+        }
+    }
+    if (optind == argc || nselected == 0)
+        goto usage;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    child = fork();
+    if (child < 0) {
+        perror("fork");
+        return 1;
+    }
+    if (child == 0) {
+        // Stop so the parent can set options before the filter can fire.
+        if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) < 0 || raise(SIGSTOP) < 0 || install_filter() < 0) {
+            perror("sctrace: child setup");
+            _exit(127);
+        }
+        execvp(argv[optind], argv + optind);
+        perror(argv[optind]);
+        _exit(127);
+    }
+
+    if (waitpid(child, &status, 0) < 0 || !WIFSTOPPED(status)) {
+        fprintf(stderr, "sctrace: child did not stop\n");
+        return 1;
+    }
+    ptrace(PTRACE_SETOPTIONS, child, NULL, PTRACE_O_TRACESECCOMP | PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL | PTRACE_O_TRACEEXEC |
+           PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK | PTRACE_O_TRACECLONE);
+    tracee_find(child, 1);
+    ptrace(PTRACE_CONT, child, NULL, NULL);
+
+    for (;;) {
+        struct tracee *t;
+        pid_t pid = waitpid(-1, &status, __WALL);
+        int sig = 0;
+
+        if (pid < 0) {
+            if (errno == EINTR)
+                continue;
+            break;              // ECHILD: every tracee is gone
+        }
+
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            if (pid == child)
+                exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+            t = tracee_find(pid, 0);
+            if (t)
+                t->pid = -1;
+            continue;
+        }
+        if (!WIFSTOPPED(status))
+            continue;
+
+        t = tracee_find(pid, 0);
+        if (t == NULL) {
+            // First stop of an auto-attached child is its initial SIGSTOP.
+            t = tracee_find(pid, 1);
+            if (WSTOPSIG(status) == SIGSTOP) {
+                ptrace(PTRACE_CONT, pid, NULL, NULL);
+                continue;
+            }
+        }
+
+        if (status >> 8 == (SIGTRAP | (PTRACE_EVENT_SECCOMP << 8))) {
+            unsigned long idx;
+
+            ptrace(PTRACE_GETEVENTMSG, pid, NULL, &idx);
+            if (idx < (unsigned long)nselected) {
+                selected[idx].calls++;
+                if (timing && t) {
+                    t->in_call = idx;
+                    clock_gettime(CLOCK_MONOTONIC, &t->entered);
+                    // Run to syscall-exit-stop of this one call only.
+                    ptrace(PTRACE_SYSCALL, pid, NULL, NULL);
+                    continue;
+                }
+            }
+        } else if (WSTOPSIG(status) == (SIGTRAP | 0x80)) {
+            if (t && t->in_call >= 0) {
+                struct ptrace_syscall_info info;
+                struct timespec now;
+
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                selected[t->in_call].seconds += elapsed(&t->entered, &now);
+                if (ptrace(PTRACE_GET_SYSCALL_INFO, pid, sizeof(info), &info) > 0 &&
+                    info.op == PTRACE_SYSCALL_INFO_EXIT && info.exit.is_error)
+                    selected[t->in_call].errors++;
+                t->in_call = -1;
+            }
+        } else if (status >> 16 == 0) {
+            // A real signal: deliver it. Event stops (fork, clone...) carry none.
+            sig = WSTOPSIG(status);
+        }
+        // Inside a timed call (e.g. the clone or exec event stop of a
+        // selected clone/execve), keep going to its syscall-exit-stop.
+        ptrace(t && t->in_call >= 0 ? PTRACE_SYSCALL : PTRACE_CONT, pid, NULL, sig);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (outpath) {
+        out = fopen(outpath, "w");
+        if (out == NULL) {
+            perror(outpath);
+            out = stderr;
+        }
+    }
+    report(out, timing, elapsed(&start, &end));
+    if (out != stderr)
+        fclose(out);
+    return exit_code;
+
+usage:
+    fprintf(stderr, "usage: sctrace [-t] [-o file] -e syscall[,syscall...] command [args...]\n");
+    return 1;
+}
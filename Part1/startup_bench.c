@@ -0,0 +1,173 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/*
+ * Startup cost of a do-nothing program, for each of the empty.c build
+ * variants (or any programs named on the command line). Timed runs use
+ * vfork + execve + wait4, so the parent's address space is never copied and
+ * the clock covers exec, the program's own startup and exit, and reaping.
+ * Faults come from the wait4 rusage of those runs.
+ *
+ * One extra run per program is made under ptrace to count the syscalls it
+ * makes after exec and to read its peak RSS from /proc just before it exits.
+ *
+ * usage: startup_bench [-n runs] [program...]
+ */
+
+static const char *default_programs[] = {
+    "./empty_dynamic", "./empty_static", "./empty_static_pie", "./empty_nostdlib",
+};
+
+extern char **environ;
+
+static double now_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static double pct(const double *sorted, long n, double p) {
+    return sorted[(long)(p / 100.0 * (n - 1) + 0.5)];
+}
+
+// One run under ptrace: syscalls after exec, and VmHWM in kB at exit.
+static int inspect(const char *path, long *syscalls, long *hwm_kb) {
+    char *argv[] = { (char *)path, NULL };
+    char proc[64], line[256];
+    int status, after_exec = 0, in_syscall = 0;
+    FILE *f;
+    pid_t pid;
+
+    *syscalls = 0;
+    *hwm_kb = -1;
+    pid = fork();
+    if (pid < 0)
+        return -1;
+    if (pid == 0) {
+        ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+        raise(SIGSTOP);
+        execve(path, argv, environ);
+        _exit(127);
+    }
+
+    waitpid(pid, &status, 0);
+    ptrace(PTRACE_SETOPTIONS, pid, NULL, PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACEEXEC | PTRACE_O_TRACEEXIT |
+           PTRACE_O_EXITKILL);
+    ptrace(PTRACE_SYSCALL, pid, NULL, NULL);
+
+    // Syscall stops alternate entry/exit. The exec event arrives inside
+    // execve, so the next stop is its exit; count execve plus every entry.
+    while (waitpid(pid, &status, 0) == pid && WIFSTOPPED(status)) {
+        int event = status >> 16;
+
+        if (event == PTRACE_EVENT_EXEC) {
+            after_exec = 1;
+            in_syscall = 1;
+            *syscalls = 1;
+        } else if (event == PTRACE_EVENT_EXIT) {
+            snprintf(proc, sizeof(proc), "/proc/%d/status", pid);
+            f = fopen(proc, "r");
+            while (f && fgets(line, sizeof(line), f))
+                if (strncmp(line, "VmHWM:", 6) == 0)
+                    *hwm_kb = atol(line + 6);
+            if (f)
+                fclose(f);
+        } else if (WSTOPSIG(status) == (SIGTRAP | 0x80) && after_exec) {
+            in_syscall = !in_syscall;
+            if (in_syscall)
+                (*syscalls)++;
+        }
+        ptrace(PTRACE_SYSCALL, pid, NULL, NULL);
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+static void bench(const char *path, long runs, double *samples) {
+    char *argv[] = { (char *)path, NULL };
+    long minflt = 0, majflt = 0, syscalls, hwm_kb;
+    struct rusage ru;
+    double t0, sum = 0;
+    int status;
+    long i;
+
+    if (access(path, X_OK) != 0) {
+        printf("%-20s missing, skipped\n", path);
+        return;
+    }
+    if (inspect(path, &syscalls, &hwm_kb) < 0) {
+        printf("%-20s failed to run, skipped\n", path);
+        return;
+    }
+
+    for (i = 0; i < runs; i++) {
+        pid_t pid;
+
+        t0 = now_us();
+        pid = vfork();
+        if (pid == 0) {
+            execve(path, argv, environ);
+            _exit(127);
+        }
+        if (pid < 0 || wait4(pid, &status, 0, &ru) < 0) {
+            perror("vfork/wait4");
+            return;
+        }
+        samples[i] = now_us() - t0;
+        sum += samples[i];
+        minflt += ru.ru_minflt;
+        majflt += ru.ru_majflt;
+    }
+
+    qsort(samples, runs, sizeof(*samples), cmp_double);
+    printf("%-20s %7.1f %7.1f %7.1f %7.1f %7.1f %7.1f %8ld %8.1f %8.2f %8ld\n", path, sum / runs, samples[0],
+           pct(samples, runs, 50), pct(samples, runs, 90), pct(samples, runs, 99), samples[runs - 1], syscalls,
+           (double)minflt / runs, (double)majflt / runs, hwm_kb);
+}
+
+int main(int argc, char **argv) {
+    long runs = 5000;
+    double *samples;
+    int opt, i;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+        case 'n': runs = atol(optarg); break;
+        default:
+            fprintf(stderr, "usage: startup_bench [-n runs] [program...]\n");
+            return -1;
+        }
+    }
+    if (runs < 1)
+        return -1;
+    samples = malloc(runs * sizeof(*samples));
+    if (samples == NULL)
+        return -1;
+
+    printf("%ld runs each, times in us\n", runs);
+    printf("%-20s %7s %7s %7s %7s %7s %7s %8s %8s %8s %8s\n", "program", "mean", "min", "p50", "p90", "p99", "max",
+           "syscalls", "minflt", "majflt", "hwm_kb");
+    if (optind < argc)
+        for (i = optind; i < argc; i++)
+            bench(argv[i], runs, samples);
+    else
+        for (i = 0; i < (int)(sizeof(default_programs) / sizeof(default_programs[0])); i++)
+            bench(default_programs[i], runs, samples);
+
+    free(samples);
+    return 0;
+}
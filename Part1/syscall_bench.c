@@ -0,0 +1,229 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+
+/*
+ * Per-call cost of the syscalls part1.c makes (write, read, open, close,
+ * getpid), plus the elevator syscalls when the kernel has them. Each call
+ * is timed on its own so we get a distribution, not just a mean; the cost
+ * of reading the timer is measured first and subtracted. Output is CSV, one
+ * row per syscall, so runs from different hosts and kernels can be
+ * concatenated and compared.
+ *
+ * usage: syscall_bench [-n iterations] [-w warmup] [-c cpu|-1] [-t tsc|clock] [-e] [-H]
+ */
+
+#define __NR_START_ELEVATOR 548
+#define __NR_ISSUE_REQUEST 549
+#define __NR_STOP_ELEVATOR 550
+
+#define BENCH_FILE "syscall_bench.tmp"
+#define MSG "Hello, System Call 1!\n"
+
+static int null_fd, zero_fd, file_fd;
+static char buffer[50];
+
+static long b_getpid(void) { return syscall(SYS_getpid); }
+static long b_write(void) { return write(null_fd, MSG, sizeof(MSG) - 1); }
+static long b_read(void) { return read(zero_fd, buffer, sizeof(buffer)); }
+static long b_open(void) { return file_fd = open(BENCH_FILE, O_CREAT | O_WRONLY, 0644); }
+static long b_close(void) { return close(file_fd); }
+static void open_file(void) { file_fd = open(BENCH_FILE, O_CREAT | O_WRONLY, 0644); }
+static void close_file(void) { close(file_fd); }
+
+// An invalid floor is rejected right after dispatch, so this is the cost of
+// reaching the module, without side effects on the elevator.
+static long b_issue(void) { return syscall(__NR_ISSUE_REQUEST, 0, 0, 0); }
+// After the first call these hit the "already started/stopping" early exit.
+static long b_start(void) { return syscall(__NR_START_ELEVATOR); }
+static long b_stop(void) { return syscall(__NR_STOP_ELEVATOR); }
+
+struct bench {
+    const char *name;
+    long (*fn)(void);
+    void (*pre)(void);      // untimed, before each call
+    void (*post)(void);     // untimed, after each call
+    int elevator;           // 1: skipped if ENOSYS, 2: also needs -e
+};
+
+static const struct bench benches[] = {
+    { "getpid", b_getpid, NULL, NULL, 0 },
+    { "write", b_write, NULL, NULL, 0 },
+    { "read", b_read, NULL, NULL, 0 },
+    { "open", b_open, NULL, close_file, 0 },
+    { "close", b_close, open_file, NULL, 0 },
+    { "issue_request", b_issue, NULL, NULL, 1 },
+    { "start_elevator", b_start, NULL, NULL, 2 },
+    { "stop_elevator", b_stop, NULL, NULL, 2 },
+};
+
+static int use_tsc;
+static double tsc_per_ns = 1.0;
+
+static inline unsigned long long clock_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+// lfence keeps rdtsc from running ahead of, or behind, the timed call.
+static inline unsigned long long tsc(void) {
+    unsigned long long t;
+
+    _mm_lfence();
+    t = __rdtsc();
+    _mm_lfence();
+    return t;
+}
+#define HAVE_TSC 1
+#else
+static inline unsigned long long tsc(void) { return 0; }
+#define HAVE_TSC 0
+#endif
+
+static inline unsigned long long ticks(void) {
+    return use_tsc ? tsc() : clock_ns();
+}
+
+static void calibrate_tsc(void) {
+    unsigned long long t0 = tsc(), n0 = clock_ns();
+    struct timespec pause = { 0, 100000000 };
+
+    nanosleep(&pause, NULL);
+    tsc_per_ns = (double)(tsc() - t0) / (clock_ns() - n0);
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static double pct(const double *sorted, long n, double p) {
+    long i = (long)(p / 100.0 * (n - 1) + 0.5);
+
+    return sorted[i];
+}
+
+// Median cost of two back-to-back timer reads, in ns.
+static double timer_overhead(double *samples, long n) {
+    unsigned long long t0;
+    long i;
+
+    for (i = 0; i < n; i++) {
+        t0 = ticks();
+        samples[i] = (ticks() - t0) / tsc_per_ns;
+    }
+    qsort(samples, n, sizeof(*samples), cmp_double);
+    return pct(samples, n, 50);
+}
+
+static void run(const struct bench *b, double *samples, long iterations, long warmup, double overhead,
+                int cpu, const char *kernel) {
+    unsigned long long t0, t1;
+    double sum = 0;
+    long i;
+
+    for (i = 0; i < warmup + iterations; i++) {
+        if (b->pre)
+            b->pre();
+        t0 = ticks();
+        b->fn();
+        t1 = ticks();
+        if (b->post)
+            b->post();
+        if (i >= warmup) {
+            double ns = (t1 - t0) / tsc_per_ns - overhead;
+
+            samples[i - warmup] = ns > 0 ? ns : 0;
+            sum += samples[i - warmup];
+        }
+    }
+
+    qsort(samples, iterations, sizeof(*samples), cmp_double);
+    printf("%s,%s,%d,%s,%ld,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f\n", kernel, b->name, cpu,
+           use_tsc ? "tsc" : "clock", iterations, overhead, sum / iterations, samples[0],
+           pct(samples, iterations, 50), pct(samples, iterations, 90), pct(samples, iterations, 99),
+           pct(samples, iterations, 99.9), samples[iterations - 1]);
+}
+
+int main(int argc, char **argv) {
+    long iterations = 100000, warmup = 1000;
+    int cpu = 0, elevator = 0, header = 1;
+    double *samples, overhead;
+    struct utsname uts;
+    cpu_set_t set;
+    size_t i;
+    int opt;
+
+    use_tsc = HAVE_TSC;
+    while ((opt = getopt(argc, argv, "n:w:c:t:eH")) != -1) {
+        switch (opt) {
+        case 'n': iterations = atol(optarg); break;
+        case 'w': warmup = atol(optarg); break;
+        case 'c': cpu = atoi(optarg); break;
+        case 't': use_tsc = HAVE_TSC && strcmp(optarg, "tsc") == 0; break;
+        case 'e': elevator = 1; break;
+        case 'H': header = 0; break;
+        default:
+            fprintf(stderr, "usage: syscall_bench [-n iterations] [-w warmup] [-c cpu|-1] [-t tsc|clock] [-e] [-H]\n"
+                            "  -e  also time start_elevator/stop_elevator (stops a running elevator)\n"
+                            "  -H  omit the CSV header, for appending to an existing file\n");
+            return -1;
+        }
+    }
+    if (iterations < 1 || warmup < 0)
+        return -1;
+
+    if (cpu >= 0) {
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+            perror("sched_setaffinity");
+            return -1;
+        }
+    }
+
+    null_fd = open("/dev/null", O_WRONLY);
+    zero_fd = open("/dev/zero", O_RDONLY);
+    samples = malloc(iterations * sizeof(*samples));
+    if (null_fd < 0 || zero_fd < 0 || samples == NULL) {
+        perror("setup");
+        return -1;
+    }
+
+    if (use_tsc)
+        calibrate_tsc();
+    overhead = timer_overhead(samples, iterations);
+    uname(&uts);
+
+    if (header)
+        printf("kernel,syscall,cpu,timer,iterations,timer_overhead_ns,mean_ns,min_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns\n");
+
+    for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+        const struct bench *b = &benches[i];
+
+        if (b->elevator == 2 && !elevator)
+            continue;
+        if (b->elevator && b->fn() == -1 && errno == ENOSYS) {
+            fprintf(stderr, "%s: not available (ENOSYS), skipped\n", b->name);
+            continue;
+        }
+        run(b, samples, iterations, warmup, overhead, cpu, uts.release);
+    }
+
+    unlink(BENCH_FILE);
+    free(samples);
+    return 0;
+}
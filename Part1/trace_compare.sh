@@ -0,0 +1,35 @@
+#!/bin/bash
+# Mean wall time per run of ./empty and ./part1, untraced, under strace,
+# and under sctrace (seccomp-filtered ptrace), to show what tracing costs.
+#
+# usage: ./trace_compare.sh [runs] [syscalls]
+#   runs      runs per configuration (default 500)
+#   syscalls  sctrace selection (default write)
+
+RUNS=${1:-500}
+SELECT=${2:-write}
+
+run_many() {
+    local start end i
+    start=$(date +%s%N)
+    for ((i = 0; i < RUNS; i++)); do
+        "$@" </dev/null >/dev/null 2>&1
+    done
+    end=$(date +%s%N)
+    echo $(( (end - start) / RUNS / 1000 ))
+}
+
+make -s empty part1 sctrace || exit 1
+
+printf "%-8s %12s %12s %12s\n" "program" "plain_us" "strace_us" "sctrace_us"
+for prog in ./empty ./part1; do
+    plain=$(run_many "$prog")
+    if command -v strace >/dev/null; then
+        traced=$(run_many strace -f -o /dev/null "$prog")
+    else
+        traced="n/a"
+    fi
+    filtered=$(run_many ./sctrace -o /dev/null -e "$SELECT" "$prog")
+    printf "%-8s %12s %12s %12s\n" "${prog#./}" "$plain" "$traced" "$filtered"
+done
+rm -f testfile.txt
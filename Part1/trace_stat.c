@@ -0,0 +1,558 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Summarise strace logs (e.g. strace -f -tt -T -o x.trace) per syscall and
+ * per pid: calls, errors, total time and a log2 latency histogram. The file
+ * is mapped and cut into one chunk per thread at line boundaries; each
+ * thread fills its own tables and they are merged at the end, so parsing
+ * runs at memory/disk bandwidth rather than one line at a time.
+ *
+ * Understands optional pid prefixes ("123 " or "[pid 123] "), -t/-tt/-ttt/-r
+ * timestamps, <unfinished ...> / <... resumed> pairs (counted once, at the
+ * resume, which carries the duration), and the --- signal / +++ exit lines.
+ * Without -T, durations are zero and only counts are meaningful.
+ *
+ * usage: trace_stat [-j threads] [-p top_pids] [-H] file
+ *        trace_stat [-j threads] -d file_a file_b
+ */
+
+#define NAME_LEN 32
+#define HIST_BUCKETS 32     // bucket 0: <1 us, bucket i: [2^(i-1), 2^i) us
+
+struct sc_stat {
+    char name[NAME_LEN];    // empty: free slot
+    unsigned long calls;
+    unsigned long errors;
+    double seconds;
+    unsigned long hist[HIST_BUCKETS];
+};
+
+struct pid_stat {
+    long pid;               // 0: free slot
+    unsigned long calls;
+    unsigned long errors;
+    double seconds;
+    unsigned long hist[HIST_BUCKETS];
+};
+
+// Open-addressed tables that double when half full.
+struct sc_table {
+    struct sc_stat *slots;
+    size_t cap, used;
+};
+
+struct pid_table {
+    struct pid_stat *slots;
+    size_t cap, used;
+};
+
+struct analysis {
+    struct sc_table sc;
+    struct pid_table pids;
+    unsigned long lines;
+    unsigned long unparsed;
+};
+
+struct chunk {
+    const char *start, *end;
+    struct analysis a;
+    pthread_t thread;
+};
+
+static size_t hash_name(const char *s, size_t len) {
+    size_t h = 14695981039346656037UL;
+
+    while (len--)
+        h = (h ^ (unsigned char)*s++) * 1099511628211UL;
+    return h;
+}
+
+static void sc_init(struct sc_table *t, size_t cap) {
+    t->cap = cap;
+    t->used = 0;
+    t->slots = calloc(cap, sizeof(*t->slots));
+}
+
+static struct sc_stat *sc_get(struct sc_table *t, const char *name, size_t len);
+
+static void sc_grow(struct sc_table *t) {
+    struct sc_table bigger;
+    size_t i;
+
+    sc_init(&bigger, t->cap * 2);
+    for (i = 0; i < t->cap; i++)
+        if (t->slots[i].name[0])
+            *sc_get(&bigger, t->slots[i].name, strlen(t->slots[i].name)) = t->slots[i];
+    free(t->slots);
+    *t = bigger;
+}
+
+static struct sc_stat *sc_get(struct sc_table *t, const char *name, size_t len) {
+    size_t i;
+
+    if (len >= NAME_LEN)
+        len = NAME_LEN - 1;
+    if (2 * (t->used + 1) > t->cap)
+        sc_grow(t);
+    for (i = hash_name(name, len) & (t->cap - 1);; i = (i + 1) & (t->cap - 1)) {
+        struct sc_stat *s = &t->slots[i];
+
+        if (s->name[0] == '\0') {
+            memcpy(s->name, name, len);
+            s->name[len] = '\0';
+            t->used++;
+            return s;
+        }
+        if (strncmp(s->name, name, len) == 0 && s->name[len] == '\0')
+            return s;
+    }
+}
+
+static void pid_init(struct pid_table *t, size_t cap) {
+    t->cap = cap;
+    t->used = 0;
+    t->slots = calloc(cap, sizeof(*t->slots));
+}
+
+static struct pid_stat *pid_get(struct pid_table *t, long pid);
+
+static void pid_grow(struct pid_table *t) {
+    struct pid_table bigger;
+    size_t i;
+
+    pid_init(&bigger, t->cap * 2);
+    for (i = 0; i < t->cap; i++)
+        if (t->slots[i].pid)
+            *pid_get(&bigger, t->slots[i].pid) = t->slots[i];
+    free(t->slots);
+    *t = bigger;
+}
+
+static struct pid_stat *pid_get(struct pid_table *t, long pid) {
+    size_t i;
+
+    if (2 * (t->used + 1) > t->cap)
+        pid_grow(t);
+    for (i = (size_t)pid * 2654435761UL & (t->cap - 1);; i = (i + 1) & (t->cap - 1)) {
+        struct pid_stat *s = &t->slots[i];
+
+        if (s->pid == 0) {
+            s->pid = pid;
+            t->used++;
+            return s;
+        }
+        if (s->pid == pid)
+            return s;
+    }
+}
+
+static void analysis_init(struct analysis *a) {
+    sc_init(&a->sc, 256);
+    pid_init(&a->pids, 64);
+    a->lines = a->unparsed = 0;
+}
+
+static void analysis_free(struct analysis *a) {
+    free(a->sc.slots);
+    free(a->pids.slots);
+}
+
+static int hist_bucket(double seconds) {
+    double us = seconds * 1e6;
+    int b = 0;
+
+    while (us >= 1 && b < HIST_BUCKETS - 1) {
+        us /= 2;
+        b++;
+    }
+    return b;
+}
+
+static int ends_with(const char *p, const char *end, const char *suffix) {
+    size_t n = strlen(suffix);
+
+    return (size_t)(end - p) >= n && memcmp(end - n, suffix, n) == 0;
+}
+
+static void parse_line(struct analysis *a, const char *p, const char *end) {
+    const char *name, *q;
+    double seconds = 0;
+    long pid = 0;
+    int error = 0;
+    size_t len;
+    struct sc_stat *s;
+
+    a->lines++;
+    while (p < end && *p == ' ')
+        p++;
+
+    // pid prefix: "[pid 123] " or "123 " (a timestamp has ':' or '.' after its digits)
+    if (p < end && *p == '[') {
+        for (q = p; q < end && !isdigit((unsigned char)*q); q++)
+            ;
+        pid = strtol(q, (char **)&q, 10);
+        while (q < end && (*q == ']' || *q == ' '))
+            q++;
+        p = q;
+    } else if (p < end && isdigit((unsigned char)*p)) {
+        for (q = p; q < end && isdigit((unsigned char)*q); q++)
+            ;
+        if (q < end && *q == ' ') {
+            pid = strtol(p, NULL, 10);
+            p = q;
+            while (p < end && *p == ' ')
+                p++;
+        }
+    }
+
+    // timestamp: any run of digits, ':' and '.' followed by a space
+    if (p < end && isdigit((unsigned char)*p)) {
+        for (q = p; q < end && (isdigit((unsigned char)*q) || *q == ':' || *q == '.'); q++)
+            ;
+        if (q < end && *q == ' ')
+            p = q + 1;
+    }
+
+    if (end - p >= 3 && (memcmp(p, "---", 3) == 0 || memcmp(p, "+++", 3) == 0))
+        return;
+    if (ends_with(p, end, "<unfinished ...>"))
+        return;
+
+    if (end - p > 5 && memcmp(p, "<... ", 5) == 0) {
+        name = p + 5;
+        for (q = name; q < end && *q != ' '; q++)
+            ;
+    } else {
+        name = p;
+        for (q = name; q < end && (isalnum((unsigned char)*q) || *q == '_'); q++)
+            ;
+        if (q == end || *q != '(') {
+            a->unparsed++;
+            return;
+        }
+    }
+    len = q - name;
+    if (len == 0) {
+        a->unparsed++;
+        return;
+    }
+
+    // trailing "<0.000123>" from -T
+    q = end;
+    if (end > p && end[-1] == '>') {
+        for (q = end - 1; q > p && *q != '<'; q--)
+            ;
+        if (q > p && isdigit((unsigned char)q[1]))
+            seconds = strtod(q + 1, NULL);
+        else
+            q = end;
+    }
+
+    // the return value is after the last " = " before the duration
+    for (; q - p >= 3; q--) {
+        if (q[-3] == ' ' && q[-2] == '=' && q[-1] == ' ') {
+            error = end - q > 3 && q[0] == '-' && q[1] == '1' && q[2] == ' ' && isupper((unsigned char)q[3]);
+            break;
+        }
+    }
+
+    s = sc_get(&a->sc, name, len);
+    s->calls++;
+    s->errors += error;
+    s->seconds += seconds;
+    s->hist[hist_bucket(seconds)]++;
+
+    if (pid) {
+        struct pid_stat *ps = pid_get(&a->pids, pid);
+
+        ps->calls++;
+        ps->errors += error;
+        ps->seconds += seconds;
+        ps->hist[hist_bucket(seconds)]++;
+    }
+}
+
+static void *parse_chunk(void *arg) {
+    struct chunk *c = arg;
+    const char *p = c->start, *nl;
+
+    while (p < c->end) {
+        nl = memchr(p, '\n', c->end - p);
+        if (nl == NULL)
+            nl = c->end;
+        if (nl > p)
+            parse_line(&c->a, p, nl);
+        p = nl + 1;
+    }
+    return NULL;
+}
+
+static void merge(struct analysis *into, const struct analysis *a) {
+    size_t i;
+    int b;
+
+    for (i = 0; i < a->sc.cap; i++) {
+        const struct sc_stat *s = &a->sc.slots[i];
+        struct sc_stat *t;
+
+        if (s->name[0] == '\0')
+            continue;
+        t = sc_get(&into->sc, s->name, strlen(s->name));
+        t->calls += s->calls;
+        t->errors += s->errors;
+        t->seconds += s->seconds;
+        for (b = 0; b < HIST_BUCKETS; b++)
+            t->hist[b] += s->hist[b];
+    }
+    for (i = 0; i < a->pids.cap; i++) {
+        const struct pid_stat *s = &a->pids.slots[i];
+        struct pid_stat *t;
+
+        if (s->pid == 0)
+            continue;
+        t = pid_get(&into->pids, s->pid);
+        t->calls += s->calls;
+        t->errors += s->errors;
+        t->seconds += s->seconds;
+        for (b = 0; b < HIST_BUCKETS; b++)
+            t->hist[b] += s->hist[b];
+    }
+    into->lines += a->lines;
+    into->unparsed += a->unparsed;
+}
+
+static int analyze(const char *path, int threads, struct analysis *out) {
+    struct chunk *chunks;
+    struct stat st;
+    const char *data, *p;
+    struct timespec t0, t1;
+    double secs;
+    int fd, i;
+
+    analysis_init(out);
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(path);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror(path);
+        return -1;
+    }
+    madvise((void *)data, st.st_size, MADV_SEQUENTIAL | MADV_WILLNEED);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if ((off_t)threads > st.st_size / 65536 + 1)
+        threads = st.st_size / 65536 + 1;
+    chunks = calloc(threads, sizeof(*chunks));
+
+    // cut at the first newline after each nominal boundary
+    p = data;
+    for (i = 0; i < threads; i++) {
+        const char *end = data + st.st_size * (i + 1) / threads;
+        const char *nl = i == threads - 1 ? NULL : memchr(end, '\n', data + st.st_size - end);
+
+        chunks[i].start = p;
+        chunks[i].end = nl ? nl + 1 : data + st.st_size;
+        if (chunks[i].end < p)
+            chunks[i].end = p;
+        p = chunks[i].end;
+        analysis_init(&chunks[i].a);
+        pthread_create(&chunks[i].thread, NULL, parse_chunk, &chunks[i]);
+    }
+    for (i = 0; i < threads; i++) {
+        pthread_join(chunks[i].thread, NULL);
+        merge(out, &chunks[i].a);
+        analysis_free(&chunks[i].a);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    fprintf(stderr, "%s: %lld bytes, %lu lines, %lu unparsed, %d threads, %.3f s (%.0f MB/s)\n", path,
+            (long long)st.st_size, out->lines, out->unparsed, threads, secs, st.st_size / secs / 1e6);
+
+    free(chunks);
+    munmap((void *)data, st.st_size);
+    return 0;
+}
+
+static struct sc_stat **sorted_syscalls(const struct analysis *a, size_t *n) {
+    struct sc_stat **v = malloc(a->sc.used * sizeof(*v) + 1);
+    size_t i;
+
+    *n = 0;
+    for (i = 0; i < a->sc.cap; i++)
+        if (a->sc.slots[i].name[0])
+            v[(*n)++] = &a->sc.slots[i];
+    return v;
+}
+
+static int by_time(const void *x, const void *y) {
+    const struct sc_stat *a = *(struct sc_stat * const *)x, *b = *(struct sc_stat * const *)y;
+
+    if (a->seconds != b->seconds)
+        return a->seconds < b->seconds ? 1 : -1;
+    return a->calls < b->calls ? 1 : a->calls > b->calls ? -1 : 0;
+}
+
+static int pid_by_time(const void *x, const void *y) {
+    const struct pid_stat *a = x, *b = y;
+
+    if (a->seconds != b->seconds)
+        return a->seconds < b->seconds ? 1 : -1;
+    return a->calls < b->calls ? 1 : a->calls > b->calls ? -1 : 0;
+}
+
+// Upper bound of the bucket holding the pct-th percentile, in us.
+static double hist_pct(const unsigned long *hist, unsigned long calls, double pct) {
+    unsigned long want = (unsigned long)(calls * pct / 100.0 + 0.5), seen = 0;
+    int b;
+
+    for (b = 0; b < HIST_BUCKETS; b++) {
+        seen += hist[b];
+        if (seen >= want && seen > 0)
+            return (double)(1UL << b);
+    }
+    return (double)(1UL << (HIST_BUCKETS - 1));
+}
+
+static void print_hist(const char *label, const unsigned long *hist) {
+    int b;
+
+    printf("%-24s", label);
+    for (b = 0; b < HIST_BUCKETS; b++)
+        if (hist[b])
+            printf(" <%lu:%lu", 1UL << b, hist[b]);
+    printf("\n");
+}
+
+static void report(const struct analysis *a, int top_pids, int histograms) {
+    struct pid_stat *pids;
+    struct sc_stat **v;
+    char p50[16], p99[16], label[32];
+    size_t n, i, np = 0;
+
+    v = sorted_syscalls(a, &n);
+    qsort(v, n, sizeof(*v), by_time);
+    printf("%-24s %10s %8s %12s %10s %10s %10s\n", "syscall", "calls", "errors", "total_s", "avg_us", "p50_us", "p99_us");
+    for (i = 0; i < n; i++) {
+        snprintf(p50, sizeof(p50), "<=%.0f", hist_pct(v[i]->hist, v[i]->calls, 50));
+        snprintf(p99, sizeof(p99), "<=%.0f", hist_pct(v[i]->hist, v[i]->calls, 99));
+        printf("%-24s %10lu %8lu %12.6f %10.2f %10s %10s\n", v[i]->name, v[i]->calls, v[i]->errors,
+               v[i]->seconds, 1e6 * v[i]->seconds / v[i]->calls, p50, p99);
+    }
+
+    if (histograms) {
+        printf("\nlatency histograms (us):\n");
+        for (i = 0; i < n; i++)
+            print_hist(v[i]->name, v[i]->hist);
+    }
+    free(v);
+
+    if (top_pids > 0 && a->pids.used > 0) {
+        pids = malloc(a->pids.used * sizeof(*pids));
+        for (i = 0; i < a->pids.cap; i++)
+            if (a->pids.slots[i].pid)
+                pids[np++] = a->pids.slots[i];
+        qsort(pids, np, sizeof(*pids), pid_by_time);
+        printf("\n%-10s %10s %8s %12s %10s %10s %10s   (top %d of %zu pids)\n", "pid", "calls", "errors", "total_s",
+               "avg_us", "p50_us", "p99_us", top_pids, np);
+        for (i = 0; i < np && i < (size_t)top_pids; i++) {
+            snprintf(p50, sizeof(p50), "<=%.0f", hist_pct(pids[i].hist, pids[i].calls, 50));
+            snprintf(p99, sizeof(p99), "<=%.0f", hist_pct(pids[i].hist, pids[i].calls, 99));
+            printf("%-10ld %10lu %8lu %12.6f %10.2f %10s %10s\n", pids[i].pid, pids[i].calls, pids[i].errors,
+                   pids[i].seconds, 1e6 * pids[i].seconds / pids[i].calls, p50, p99);
+        }
+
+        if (histograms) {
+            printf("\nlatency histograms by pid (us):\n");
+            for (i = 0; i < np && i < (size_t)top_pids; i++) {
+                snprintf(label, sizeof(label), "%ld", pids[i].pid);
+                print_hist(label, pids[i].hist);
+            }
+        }
+        free(pids);
+    }
+}
+
+static void report_diff(struct analysis *a, struct analysis *b) {
+    struct sc_stat **v;
+    struct analysis both;
+    size_t n, i;
+
+    // the union of names, ordered by combined time
+    analysis_init(&both);
+    merge(&both, a);
+    merge(&both, b);
+    v = sorted_syscalls(&both, &n);
+    qsort(v, n, sizeof(*v), by_time);
+
+    printf("%-24s %10s %10s %10s %12s %12s %12s\n", "syscall", "calls_a", "calls_b", "d_calls", "total_s_a",
+           "total_s_b", "d_total_s");
+    for (i = 0; i < n; i++) {
+        size_t len = strlen(v[i]->name);
+        struct sc_stat *x = sc_get(&a->sc, v[i]->name, len);
+        struct sc_stat *y = sc_get(&b->sc, v[i]->name, len);
+
+        printf("%-24s %10lu %10lu %+10ld %12.6f %12.6f %+12.6f\n", v[i]->name, x->calls, y->calls,
+               (long)y->calls - (long)x->calls, x->seconds, y->seconds, y->seconds - x->seconds);
+    }
+    free(v);
+    analysis_free(&both);
+}
+
+int main(int argc, char **argv) {
+    struct analysis a, b;
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int top_pids = 10, histograms = 0, diff = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "j:p:Hd")) != -1) {
+        switch (opt) {
+        case 'j': threads = atoi(optarg); break;
+        case 'p': top_pids = atoi(optarg); break;
+        case 'H': histograms = 1; break;
+        case 'd': diff = 1; break;
+        default:
+            goto usage;
+        }
+    }
+    if (threads < 1)
+        threads = 1;
+    if (argc - optind != (diff ? 2 : 1))
+        goto usage;
+
+    if (analyze(argv[optind], threads, &a) < 0)
+        return 1;
+    if (diff) {
+        if (analyze(argv[optind + 1], threads, &b) < 0)
+            return 1;
+        report_diff(&a, &b);
+        analysis_free(&b);
+    } else {
+        report(&a, top_pids, histograms);
+    }
+    analysis_free(&a);
+    return 0;
+
+usage:
+    fprintf(stderr, "usage: trace_stat [-j threads] [-p top_pids] [-H] file\n"
+                    "       trace_stat [-j threads] -d file_a file_b\n");
+    return 1;
+}
@@ -4,6 +4,23 @@
 #include <linux/proc_fs.h>
 #include <linux/uaccess.h>
 #include <linux/ktime.h>
+#include <linux/timekeeping.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/hrtimer.h>
+#include <linux/mm.h>
+#include <linux/moduleparam.h>
+#include <linux/percpu.h>
+#include <linux/smp.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/math64.h>
+#include <linux/completion.h>
+#include <linux/cpu.h>
+#include <linux/timex.h>
+
+#include "my_timer_uapi.h"
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Group #");
@@ -14,58 +31,775 @@ MODULE_VERSION("1.0");
 #define PERMS 0666
 #define PARENT NULL
 
-#define BUF_LEN 100
+#define BUF_LEN 256
+#define PAGE_PERIOD_MIN_US 10
+#define PAGE_PERIOD_MAX_US 1000000  // keeps period_ns in the page's __u32
 static struct proc_dir_entry* proc_entry;
-static char msg[BUF_LEN];
-static int procfs_buf_len;
-struct timespec64 last_time;
 
-static ssize_t procfile_read(struct file *file, char __user *ubuf, size_t count, loff_t *ppos) {
-    printk(KERN_INFO "proc_read\n");
+// How often the mapped timestamp page is refreshed. Readers of the page
+// see time quantised to this period, so it trades staleness for timer load.
+static unsigned int page_period_us = 1000;
+module_param(page_period_us, uint, 0644);
+MODULE_PARM_DESC(page_period_us, "Update period of the mmap-able timestamp page in microseconds (10-1000000)");
+
+static struct my_timer_page *timer_page;
+static struct hrtimer page_timer;
+
+// Latency mode: a pinned periodic hrtimer on every online CPU (and
+// optionally a bound kthread sleeping on an absolute deadline) records how
+// late each wakeup was. CPUs brought online after load are not covered.
+#define LAT_ENTRY_NAME "my_timer_latency"
+#define LAT_BUCKETS 256     // 1 us wide; the last one holds everything slower
+#define LAT_PERIOD_MIN_US 10
+
+static unsigned int lat_period_us;
+module_param(lat_period_us, uint, 0444);
+MODULE_PARM_DESC(lat_period_us, "Wakeup latency sampling period in microseconds (0 = off, min 10)");
+
+static bool lat_kthread;
+module_param(lat_kthread, bool, 0444);
+MODULE_PARM_DESC(lat_kthread, "Also measure a sleeping kthread on every CPU");
+
+enum lat_source { LAT_HRTIMER, LAT_KTHREAD, LAT_SOURCES };
+static const char *lat_source_names[LAT_SOURCES] = {"hrtimer", "kthread"};
+
+struct lat_hist {
+    u64 count;
+    u64 sum_ns;
+    u64 min_ns;
+    u64 max_ns;
+    u64 overruns;       // periods skipped entirely because a wakeup was that late
+    u64 buckets[LAT_BUCKETS];
+};
+
+// Each CPU's histograms are only written from that CPU, by its own timer
+// or its own bound kthread, so recording takes no locks. Readers may see
+// a sample half-recorded, which only skews the totals by one.
+struct lat_cpu {
+    struct hrtimer timer;
+    bool armed;
+    struct task_struct *thread;
+    struct lat_hist hist[LAT_SOURCES];
+};
+
+static struct lat_cpu __percpu *lat_cpus;
+static ktime_t lat_period;
+static struct proc_dir_entry* lat_entry;
+
+// Skew probe: writing a round count to /proc/my_timer_skew ping-pongs a
+// cache line between bound kthreads on every pair of online CPUs. Each
+// round the initiator reads its clock (t1), the responder reads its clock
+// when it sees the ping (t2), and the initiator reads again on the pong
+// (t3). The round with the smallest t3 - t1 gives the best estimate of
+// offset = t2 - (t1 + t3) / 2, good to +/- half that round trip. Any
+// t2 outside [t1, t3] is a warp: the responder's clock is provably off.
+#define SKEW_ENTRY_NAME "my_timer_skew"
+#define SKEW_DEFAULT_ROUNDS 1000
+#define SKEW_MAX_ROUNDS 100000
+#define SKEW_TIMEOUT_NS (10 * NSEC_PER_MSEC)
+
+struct skew_result {
+    bool valid;
+    s64 offset_ns;      // ktime_get of column CPU minus row CPU
+    u64 rtt_ns;
+    s64 offset_cyc;     // same, in raw cycle counter ticks
+    u64 rtt_cyc;
+    u64 warp_ns;        // largest causality violation seen
+    u32 warps;          // rounds with any violation
+};
+
+struct skew_pair {
+    atomic_t ready;
+    int ping;           // round number published by the initiator
+    int pong;           // round number acknowledged by the responder
+    bool abort;
+    u64 t2_ns;
+    u64 t2_cyc;
+    unsigned int rounds;
+    struct skew_result result;
+    struct completion done;
+};
+
+static DEFINE_MUTEX(skew_run_lock);    // one probe at a time
+static DEFINE_MUTEX(skew_lock);        // guards the published results
+static struct skew_result *skew_results;   // nr_cpu_ids x nr_cpu_ids, row-major
+static unsigned int skew_rounds;
+static u64 skew_run_ns;
+static struct proc_dir_entry* skew_entry;
+
+// One sample of each clock. Realtime is what "current time" has always
+// shown; monotonic and raw are immune to settimeofday/NTP steps, and raw
+// is also immune to NTP slewing, so intervals measured on them are exact.
+struct timer_sample {
+    struct timespec64 real;
+    struct timespec64 mono;
+    struct timespec64 raw;
+};
+
+// Per-open state. Every opener gets its own last-read sample, so a
+// process that keeps the file open and re-reads it (pread at offset 0,
+// or lseek back to 0) sees the interval since *its* previous read, not
+// since whoever else happened to read last. The lock only serialises
+// threads sharing one struct file.
+struct timer_reader {
+    struct mutex lock;
+    struct timer_sample last;
+    char msg[BUF_LEN];
+    int len;
+};
+
+static void timer_sample_now(struct timer_sample *s) {
+    ktime_get_real_ts64(&s->real);
+    ktime_get_ts64(&s->mono);
+    ktime_get_raw_ts64(&s->raw);
+}
+
+// Format now - then as seconds.nanoseconds. Realtime can step backwards,
+// so the difference is signed and printed with its sign rather than as a
+// huge unsigned number.
+static int format_delta(char *buf, size_t size, const char *label, const struct timespec64 *now, const struct timespec64 *then) {
+    s64 delta = timespec64_to_ns(now) - timespec64_to_ns(then);
+    struct timespec64 ts = ns_to_timespec64(delta < 0 ? -delta : delta);
+
+    return snprintf(buf, size, "%s: %s%lld.%09ld\n", label, delta < 0 ? "-" : "", (long long) ts.tv_sec, ts.tv_nsec);
+}
+
+static int timer_format(struct timer_reader *r, const struct timer_sample *now) {
+    char *msg = r->msg;
+    int len;
+
+    len = snprintf(msg, BUF_LEN, "current time: %lld.%09ld\n", (long long) now->real.tv_sec, now->real.tv_nsec);
+    len += snprintf(msg + len, BUF_LEN - len, "monotonic: %lld.%09ld\n", (long long) now->mono.tv_sec, now->mono.tv_nsec);
+    len += snprintf(msg + len, BUF_LEN - len, "raw: %lld.%09ld\n", (long long) now->raw.tv_sec, now->raw.tv_nsec);
+    len += format_delta(msg + len, BUF_LEN - len, "elapsed time", &now->real, &r->last.real);
+    len += format_delta(msg + len, BUF_LEN - len, "elapsed monotonic", &now->mono, &r->last.mono);
+    len += format_delta(msg + len, BUF_LEN - len, "elapsed raw", &now->raw, &r->last.raw);
+
+    return len;
+}
+
+static ktime_t page_period(void) {
+    unsigned int us = READ_ONCE(page_period_us);
+
+    return us_to_ktime(clamp_t(unsigned int, us, PAGE_PERIOD_MIN_US, PAGE_PERIOD_MAX_US));
+}
+
+// Single writer (the hrtimer), so a bare sequence counter is enough; the
+// layout and retry rule are documented in my_timer_uapi.h.
+static void timer_page_update(ktime_t period) {
+    struct my_timer_page *p = timer_page;
+    ktime_t mono = ktime_get();
+
+    WRITE_ONCE(p->seq, p->seq + 1);
+    smp_wmb();
+    p->mono_ns = ktime_to_ns(mono);
+    p->real_ns = ktime_to_ns(ktime_mono_to_real(mono));
+    p->period_ns = ktime_to_ns(period);
+    p->updates++;
+    smp_wmb();
+    WRITE_ONCE(p->seq, p->seq + 1);
+}
+
+static enum hrtimer_restart page_timer_fn(struct hrtimer *timer) {
+    ktime_t period = page_period();
 
-    struct timespec64 current_time;
-    ktime_get_real_ts64(&current_time);
+    timer_page_update(period);
+    hrtimer_forward_now(timer, period);
+    return HRTIMER_RESTART;
+}
 
-    procfs_buf_len = snprintf(msg, sizeof(msg), "current time: %ld.%09ld\n",(long) current_time.tv_sec, current_time.tv_nsec);
+static void lat_record(struct lat_hist *h, s64 ns) {
+    u64 us;
 
-    u64 elapsed_time = ktime_to_ns(ktime_sub(ktime_set(current_time.tv_sec, current_time.tv_nsec), ktime_set(last_time.tv_sec,last_time.tv_nsec)));
+    if (ns < 0)
+        ns = 0;
+    us = div_u64(ns, NSEC_PER_USEC);
 
-    if(elapsed_time > 0)
-        procfs_buf_len += snprintf(msg + procfs_buf_len, sizeof(msg) - procfs_buf_len, "elapsed time: %lld.%09lld\n", elapsed_time / NSEC_PER_SEC);
+    if (h->count == 0 || ns < h->min_ns)
+        h->min_ns = ns;
+    if (ns > h->max_ns)
+        h->max_ns = ns;
+    h->sum_ns += ns;
+    h->count++;
+    h->buckets[us < LAT_BUCKETS ? us : LAT_BUCKETS - 1]++;
+}
 
-    if (*ppos > 0 || count < procfs_buf_len)
+static enum hrtimer_restart lat_timer_fn(struct hrtimer *timer) {
+    struct lat_cpu *lc = container_of(timer, struct lat_cpu, timer);
+    ktime_t now = ktime_get();
+    u64 missed;
+
+    lat_record(&lc->hist[LAT_HRTIMER], ktime_to_ns(ktime_sub(now, hrtimer_get_expires(timer))));
+
+    missed = hrtimer_forward(timer, now, lat_period);
+    if (missed > 1)
+        lc->hist[LAT_HRTIMER].overruns += missed - 1;
+    return HRTIMER_RESTART;
+}
+
+// Runs on the target CPU via IPI so the pinned timer lands there.
+static void lat_arm(void *data) {
+    struct lat_cpu *lc = data;
+
+    hrtimer_start(&lc->timer, ktime_add(ktime_get(), lat_period), HRTIMER_MODE_ABS_PINNED_HARD);
+}
+
+static int lat_thread_fn(void *data) {
+    struct lat_cpu *lc = data;
+    ktime_t expected;
+
+    while (!kthread_should_stop()) {
+        expected = ktime_add(ktime_get(), lat_period);
+        set_current_state(TASK_INTERRUPTIBLE);
+        // A non-zero return means kthread_stop woke us early.
+        if (schedule_hrtimeout(&expected, HRTIMER_MODE_ABS) == 0)
+            lat_record(&lc->hist[LAT_KTHREAD], ktime_to_ns(ktime_sub(ktime_get(), expected)));
+    }
+    return 0;
+}
+
+static void lat_stop(void) {
+    int cpu;
+
+    if (lat_cpus == NULL)
+        return;
+
+    for_each_possible_cpu(cpu) {
+        struct lat_cpu *lc = per_cpu_ptr(lat_cpus, cpu);
+
+        if (lc->thread)
+            kthread_stop(lc->thread);
+        if (lc->armed)
+            hrtimer_cancel(&lc->timer);
+    }
+    free_percpu(lat_cpus);
+    lat_cpus = NULL;
+}
+
+static int lat_start(void) {
+    struct task_struct *t;
+    int cpu;
+
+    // A hard pinned timer on every CPU every few us can livelock the machine.
+    if (lat_period_us < LAT_PERIOD_MIN_US) {
+        printk(KERN_NOTICE "my_timer: lat_period_us raised to %u\n", LAT_PERIOD_MIN_US);
+        lat_period_us = LAT_PERIOD_MIN_US;
+    }
+    lat_period = us_to_ktime(lat_period_us);
+    lat_cpus = alloc_percpu(struct lat_cpu);
+    if (lat_cpus == NULL)
+        return -ENOMEM;
+
+    for_each_online_cpu(cpu) {
+        struct lat_cpu *lc = per_cpu_ptr(lat_cpus, cpu);
+
+        hrtimer_setup(&lc->timer, lat_timer_fn, CLOCK_MONOTONIC, HRTIMER_MODE_ABS_PINNED_HARD);
+        smp_call_function_single(cpu, lat_arm, lc, 1);
+        lc->armed = true;
+
+        if (!lat_kthread)
+            continue;
+        t = kthread_create_on_cpu(lat_thread_fn, lc, cpu, "my_timer_lat/%u");
+        if (IS_ERR(t)) {
+            lat_stop();
+            return PTR_ERR(t);
+        }
+        lc->thread = t;
+        wake_up_process(t);
+    }
+
+    printk(KERN_INFO "my_timer: sampling wakeup latency every %u us\n", lat_period_us);
+    return 0;
+}
+
+static void lat_merge(struct lat_hist *into, const struct lat_hist *h) {
+    int i;
+
+    if (h->count == 0)
+        return;
+    if (into->count == 0 || h->min_ns < into->min_ns)
+        into->min_ns = h->min_ns;
+    if (h->max_ns > into->max_ns)
+        into->max_ns = h->max_ns;
+    into->count += h->count;
+    into->sum_ns += h->sum_ns;
+    into->overruns += h->overruns;
+    for (i = 0; i < LAT_BUCKETS; i++)
+        into->buckets[i] += h->buckets[i];
+}
+
+// Upper bound, in ns, of the bucket holding the pct-th percentile sample.
+static u64 lat_percentile(const struct lat_hist *h, unsigned int pct) {
+    u64 want = div_u64(h->count * pct + 99, 100);
+    u64 seen = 0;
+    int i;
+
+    for (i = 0; i < LAT_BUCKETS - 1; i++) {
+        seen += h->buckets[i];
+        if (seen >= want)
+            return (u64) (i + 1) * NSEC_PER_USEC;
+    }
+    return h->max_ns;
+}
+
+static void lat_show_row(struct seq_file *m, const char *source, const char *cpu, const struct lat_hist *h) {
+    seq_printf(m, "%-8s %4s %10llu %10llu %10llu %10llu %10llu %9llu\n", source, cpu, h->count,
+               h->count ? h->min_ns : 0, h->count ? div64_u64(h->sum_ns, h->count) : 0,
+               h->max_ns, h->count ? lat_percentile(h, 99) : 0, h->overruns);
+}
+
+static int lat_show(struct seq_file *m, void *v) {
+    struct lat_hist *all;
+    char name[12];
+    int src, cpu, i;
+
+    if (lat_cpus == NULL) {
+        seq_puts(m, "disabled (load with lat_period_us=N)\n");
         return 0;
+    }
+
+    all = kmalloc(sizeof(*all), GFP_KERNEL);
+    if (all == NULL)
+        return -ENOMEM;
 
-    if (copy_to_user(ubuf, msg, procfs_buf_len))
-        return -EFAULT;
+    seq_printf(m, "period: %u us\n", lat_period_us);
+    seq_printf(m, "%-8s %4s %10s %10s %10s %10s %10s %9s\n", "source", "cpu", "samples", "min_ns", "avg_ns", "max_ns", "p99_ns", "overruns");
 
-    *ppos = *ppos + procfs_buf_len;
+    for (src = 0; src < LAT_SOURCES; src++) {
+        if (src == LAT_KTHREAD && !lat_kthread)
+            continue;
 
-    last_time =  current_time;
+        memset(all, 0, sizeof(*all));
+        for_each_online_cpu(cpu) {
+            const struct lat_hist *h = &per_cpu_ptr(lat_cpus, cpu)->hist[src];
 
-    printk(KERN_INFO "gave to user: %s", msg);
+            snprintf(name, sizeof(name), "%d", cpu);
+            lat_show_row(m, lat_source_names[src], name, h);
+            lat_merge(all, h);
+        }
+        lat_show_row(m, lat_source_names[src], "all", all);
+
+        seq_printf(m, "%s histogram (us, all cpus):\n", lat_source_names[src]);
+        for (i = 0; i < LAT_BUCKETS; i++) {
+            if (all->buckets[i] == 0)
+                continue;
+            seq_printf(m, "%s%3d %llu\n", i == LAT_BUCKETS - 1 ? ">=" : "  ", i, all->buckets[i]);
+        }
+    }
+
+    kfree(all);
+    return 0;
+}
 
-    return procfs_buf_len;
+static int lat_open(struct inode *inode, struct file *file) {
+    return single_open(file, lat_show, NULL);
+}
+
+static const struct proc_ops lat_fops = {
+        .proc_open = lat_open,
+        .proc_read = seq_read,
+        .proc_lseek = seq_lseek,
+        .proc_release = single_release,
 };
 
+// An ordered counter read where the architecture has one, so the read
+// cannot be hoisted above the handshake load that precedes it.
+static inline u64 skew_cycles(void) {
+#ifdef CONFIG_X86
+    return rdtsc_ordered();
+#else
+    return get_cycles();
+#endif
+}
+
+// Spin until *var == val. Gives up past the deadline or if the other side
+// gave up, so one CPU being descheduled cannot wedge the other.
+static bool skew_wait(struct skew_pair *p, int *var, int val, u64 deadline) {
+    while (smp_load_acquire(var) != val) {
+        if (READ_ONCE(p->abort) || ktime_get_ns() > deadline) {
+            WRITE_ONCE(p->abort, true);
+            return false;
+        }
+        cpu_relax();
+    }
+    return true;
+}
+
+// Both threads must be running before the first ping, or the initiator
+// would burn its timeouts while the responder is still being scheduled.
+static bool skew_rendezvous(struct skew_pair *p) {
+    u64 deadline = ktime_get_ns() + NSEC_PER_SEC;
+
+    atomic_inc(&p->ready);
+    while (atomic_read(&p->ready) < 2) {
+        if (READ_ONCE(p->abort) || ktime_get_ns() > deadline) {
+            WRITE_ONCE(p->abort, true);
+            return false;
+        }
+        cond_resched();
+    }
+    return true;
+}
+
+static int skew_responder(void *data) {
+    struct skew_pair *p = data;
+    unsigned int r;
+
+    if (skew_rendezvous(p)) {
+        for (r = 1; r <= p->rounds; r++) {
+            if (!skew_wait(p, &p->ping, r, ktime_get_ns() + SKEW_TIMEOUT_NS))
+                break;
+            p->t2_ns = ktime_get_ns();
+            p->t2_cyc = skew_cycles();
+            smp_store_release(&p->pong, r);
+        }
+    }
+    complete(&p->done);
+    return 0;
+}
+
+static int skew_initiator(void *data) {
+    struct skew_pair *p = data;
+    struct skew_result *res = &p->result;
+    unsigned long flags;
+    u64 t1, t3, c1, c3, warp;
+    unsigned int r;
+
+    if (skew_rendezvous(p)) {
+        for (r = 1; r <= p->rounds; r++) {
+            local_irq_save(flags);
+            t1 = ktime_get_ns();
+            c1 = skew_cycles();
+            smp_store_release(&p->ping, r);
+            if (!skew_wait(p, &p->pong, r, t1 + SKEW_TIMEOUT_NS)) {
+                local_irq_restore(flags);
+                break;
+            }
+            c3 = skew_cycles();
+            t3 = ktime_get_ns();
+            local_irq_restore(flags);
+
+            warp = 0;
+            if (p->t2_ns < t1)
+                warp = t1 - p->t2_ns;
+            else if (p->t2_ns > t3)
+                warp = p->t2_ns - t3;
+            if (warp) {
+                res->warps++;
+                if (warp > res->warp_ns)
+                    res->warp_ns = warp;
+            }
+
+            if (!res->valid || t3 - t1 < res->rtt_ns) {
+                res->rtt_ns = t3 - t1;
+                res->offset_ns = (s64) (p->t2_ns - t1) - (s64) (res->rtt_ns / 2);
+            }
+            if (!res->valid || c3 - c1 < res->rtt_cyc) {
+                res->rtt_cyc = c3 - c1;
+                res->offset_cyc = (s64) (p->t2_cyc - c1) - (s64) (res->rtt_cyc / 2);
+            }
+            res->valid = true;
+        }
+    }
+    complete(&p->done);
+    return 0;
+}
+
+static int skew_probe_pair(struct skew_pair *p, unsigned int a, unsigned int b, unsigned int rounds) {
+    struct task_struct *ta, *tb;
+
+    memset(p, 0, sizeof(*p));
+    p->rounds = rounds;
+    init_completion(&p->done);
+
+    ta = kthread_create_on_cpu(skew_initiator, p, a, "my_timer_skew/%u");
+    if (IS_ERR(ta))
+        return PTR_ERR(ta);
+    tb = kthread_create_on_cpu(skew_responder, p, b, "my_timer_skew/%u");
+    if (IS_ERR(tb)) {
+        // Never woken threads exit without running their function.
+        kthread_stop(ta);
+        return PTR_ERR(tb);
+    }
+
+    wake_up_process(ta);
+    wake_up_process(tb);
+    wait_for_completion(&p->done);
+    wait_for_completion(&p->done);
+    return 0;
+}
+
+static int skew_run(unsigned int rounds) {
+    struct skew_pair *p;
+    struct skew_result *results, *res;
+    u64 start = ktime_get_ns();
+    unsigned int n = nr_cpu_ids;
+    int a, b, ret = 0;
+
+    p = kmalloc(sizeof(*p), GFP_KERNEL);
+    // n * n entries run to megabytes on big hosts, so let it fall back to vmalloc.
+    results = kvcalloc((size_t) n * n, sizeof(*results), GFP_KERNEL);
+    if (p == NULL || results == NULL) {
+        kfree(p);
+        kvfree(results);
+        return -ENOMEM;
+    }
+
+    cpus_read_lock();
+    for_each_online_cpu(a) {
+        for_each_online_cpu(b) {
+            if (b <= a)
+                continue;
+            ret = skew_probe_pair(p, a, b, rounds);
+            if (ret)
+                goto out;
+            res = &results[a * n + b];
+            *res = p->result;
+            // The reverse direction is the same measurement mirrored.
+            results[b * n + a] = *res;
+            results[b * n + a].offset_ns = -res->offset_ns;
+            results[b * n + a].offset_cyc = -res->offset_cyc;
+        }
+    }
+out:
+    cpus_read_unlock();
+    kfree(p);
+
+    if (ret) {
+        kvfree(results);
+        return ret;
+    }
+
+    mutex_lock(&skew_lock);
+    kvfree(skew_results);
+    skew_results = results;
+    skew_rounds = rounds;
+    skew_run_ns = ktime_get_ns() - start;
+    mutex_unlock(&skew_lock);
+    return 0;
+}
+
+static void skew_show_matrix(struct seq_file *m, const char *title, int field) {
+    unsigned int n = nr_cpu_ids;
+    struct skew_result *res;
+    int a, b;
+
+    seq_printf(m, "%s\n%6s", title, "");
+    for_each_online_cpu(b)
+        seq_printf(m, " %10d", b);
+    seq_putc(m, '\n');
+
+    for_each_online_cpu(a) {
+        seq_printf(m, "%6d", a);
+        for_each_online_cpu(b) {
+            res = &skew_results[a * n + b];
+            if (a == b)
+                seq_printf(m, " %10s", "-");
+            else if (!res->valid)
+                seq_printf(m, " %10s", "?");
+            else if (field == 0)
+                seq_printf(m, " %10lld", res->offset_ns);
+            else if (field == 1)
+                seq_printf(m, " %10llu", res->rtt_ns);
+            else
+                seq_printf(m, " %10lld", res->offset_cyc);
+        }
+        seq_putc(m, '\n');
+    }
+}
+
+static int skew_show(struct seq_file *m, void *v) {
+    unsigned int n = nr_cpu_ids;
+    struct skew_result *res;
+    u64 worst = 0, warp = 0;
+    u32 warps = 0;
+    int a, b;
+
+    mutex_lock(&skew_lock);
+
+    if (skew_results == NULL) {
+        seq_printf(m, "no results (echo ROUNDS > /proc/%s, default %d)\n", SKEW_ENTRY_NAME, SKEW_DEFAULT_ROUNDS);
+        goto out;
+    }
+
+    for_each_online_cpu(a) {
+        for_each_online_cpu(b) {
+            res = &skew_results[a * n + b];
+            if (b <= a || !res->valid)
+                continue;
+            worst = max_t(u64, worst, abs(res->offset_ns));
+            warp = max_t(u64, warp, res->warp_ns);
+            warps += res->warps;
+        }
+    }
+
+    seq_printf(m, "rounds per pair: %u, run time: %llu ms\n", skew_rounds, div_u64(skew_run_ns, NSEC_PER_MSEC));
+    seq_printf(m, "max |offset|: %llu ns, warps: %u, max warp: %llu ns\n", worst, warps, warp);
+    skew_show_matrix(m, "ktime offset (ns), column clock minus row clock:", 0);
+    skew_show_matrix(m, "round trip (ns):", 1);
+    skew_show_matrix(m, "cycle counter offset (ticks), column minus row:", 2);
+
+out:
+    mutex_unlock(&skew_lock);
+    return 0;
+}
+
+static int skew_open(struct inode *inode, struct file *file) {
+    return single_open(file, skew_show, NULL);
+}
+
+static ssize_t skew_write(struct file *file, const char __user *ubuf, size_t count, loff_t *ppos) {
+    unsigned int rounds;
+    int ret;
+
+    ret = kstrtouint_from_user(ubuf, count, 10, &rounds);
+    if (ret)
+        return ret;
+    if (rounds == 0)
+        rounds = SKEW_DEFAULT_ROUNDS;
+    if (rounds > SKEW_MAX_ROUNDS)
+        return -EINVAL;
+
+    // Two probes at once would measure each other, not the clocks.
+    if (!mutex_trylock(&skew_run_lock))
+        return -EBUSY;
+    ret = skew_run(rounds);
+    mutex_unlock(&skew_run_lock);
+
+    return ret ? ret : count;
+}
+
+static const struct proc_ops skew_fops = {
+        .proc_open = skew_open,
+        .proc_read = seq_read,
+        .proc_write = skew_write,
+        .proc_lseek = seq_lseek,
+        .proc_release = single_release,
+};
+
+static int procfile_open(struct inode *inode, struct file *file) {
+    struct timer_reader *r = kzalloc(sizeof(*r), GFP_KERNEL);
+
+    if (r == NULL)
+        return -ENOMEM;
+
+    mutex_init(&r->lock);
+    // The first read reports the time since open.
+    timer_sample_now(&r->last);
+    file->private_data = r;
+    return 0;
+}
+
+static int procfile_release(struct inode *inode, struct file *file) {
+    kfree(file->private_data);
+    return 0;
+}
+
+static ssize_t procfile_read(struct file *file, char __user *ubuf, size_t count, loff_t *ppos) {
+    struct timer_reader *r = file->private_data;
+    struct timer_sample now;
+    ssize_t ret;
+
+    mutex_lock(&r->lock);
+
+    // A read at offset 0 takes a fresh sample; reads past it drain what is
+    // left of the same sample, so short reads never mix two samples.
+    if (*ppos == 0) {
+        timer_sample_now(&now);
+        r->len = timer_format(r, &now);
+        r->last = now;
+    }
+
+    ret = simple_read_from_buffer(ubuf, count, ppos, r->msg, r->len);
+
+    mutex_unlock(&r->lock);
+
+    return ret;
+};
+
+// Map the timestamp page read-only. vm_insert_page takes its own page
+// reference, so existing mappings stay valid even after the module is gone.
+static int procfile_mmap(struct file *file, struct vm_area_struct *vma) {
+    if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start != PAGE_SIZE)
+        return -EINVAL;
+    if (vma->vm_flags & VM_WRITE)
+        return -EPERM;
+
+    vm_flags_clear(vma, VM_MAYWRITE);
+    return vm_insert_page(vma, vma->vm_start, virt_to_page(timer_page));
+}
+
 static const struct proc_ops procfile_fops = {
+        .proc_open = procfile_open,
         .proc_read = procfile_read,
+        .proc_lseek = default_llseek,
+        .proc_release = procfile_release,
+        .proc_mmap = procfile_mmap,
 };
 
 static int __init timer_init(void){
+        int ret;
+
+        timer_page = (struct my_timer_page *) get_zeroed_page(GFP_KERNEL);
+        if (timer_page == NULL)
+                return -ENOMEM;
+        timer_page_update(page_period());
+
+        hrtimer_setup(&page_timer, page_timer_fn, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+        hrtimer_start(&page_timer, page_period(), HRTIMER_MODE_REL);
+
         proc_entry = proc_create(ENTRY_NAME, PERMS, PARENT, &procfile_fops);
         if (proc_entry == NULL) {
                 printk(KERN_ERR "Failed to create /proc/my_timer entry\n");
+                hrtimer_cancel(&page_timer);
+                free_page((unsigned long) timer_page);
                 return -ENOMEM;
         }
         else printk(KERN_INFO "Successfully created /proc/my_timer entry/n");
-        ktime_get_real_ts64(&last_time);
+
+        // Start sampling before the proc file exists, so a reader never
+        // races with lat_start() failing and freeing the histograms.
+        if (lat_period_us > 0) {
+                ret = lat_start();
+                if (ret)
+                        goto err_proc;
+        }
+
+        lat_entry = proc_create(LAT_ENTRY_NAME, 0444, PARENT, &lat_fops);
+        if (lat_entry == NULL) {
+                printk(KERN_ERR "Failed to create /proc/my_timer_latency entry\n");
+                ret = -ENOMEM;
+                goto err_lat;
+        }
+
+        skew_entry = proc_create(SKEW_ENTRY_NAME, 0644, PARENT, &skew_fops);
+        if (skew_entry == NULL) {
+                printk(KERN_ERR "Failed to create /proc/my_timer_skew entry\n");
+                ret = -ENOMEM;
+                goto err_skew;
+        }
 
         return 0;
+
+err_skew:
+        proc_remove(lat_entry);
+err_lat:
+        lat_stop();
+err_proc:
+        proc_remove(proc_entry);
+        hrtimer_cancel(&page_timer);
+        free_page((unsigned long) timer_page);
+        return ret;
 };
 
 static void __exit timer_exit(void){
+        proc_remove(skew_entry);
+        kvfree(skew_results);
+        proc_remove(lat_entry);
+        lat_stop();
         proc_remove(proc_entry);
+        hrtimer_cancel(&page_timer);
+        free_page((unsigned long) timer_page);
 };
 
 module_init(timer_init);
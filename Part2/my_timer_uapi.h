@@ -0,0 +1,28 @@
+#ifndef __MY_TIMER_UAPI_H
+#define __MY_TIMER_UAPI_H
+
+/*
+ * Layouts shared between the my_timer module and userspace tools.
+ */
+
+#include <linux/types.h>
+
+/*
+ * mmap(NULL, 4096, PROT_READ, MAP_SHARED, fd, 0) on /proc/my_timer maps one
+ * read-only page starting with struct my_timer_page. An hrtimer rewrites it
+ * every period_ns. The fields are guarded by seq: the writer makes it odd,
+ * updates the clocks, then makes it even again. A reader loads seq, retries
+ * while it is odd, reads the fields, and retries if seq changed meanwhile.
+ *
+ * The values are as fresh as the last update, so they lag the real clocks
+ * by up to period_ns (plus timer wakeup latency).
+ */
+struct my_timer_page {
+    __u32 seq;
+    __u32 period_ns;
+    __s64 real_ns;      // CLOCK_REALTIME, ns since the epoch
+    __s64 mono_ns;      // CLOCK_MONOTONIC, ns since boot
+    __u64 updates;      // number of hrtimer updates so far
+};
+
+#endif
@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "my_timer_uapi.h"
+
+#define TIMER_PROC "/proc/my_timer"
+
+static inline int64_t now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Seqcount read side of the protocol described in my_timer_uapi.h. The
+ * volatile loads keep the benchmark loop from being optimised away. */
+static inline int64_t page_mono_ns(const volatile struct my_timer_page *p) {
+	uint32_t seq;
+	int64_t mono;
+
+	do {
+		while ((seq = __atomic_load_n(&p->seq, __ATOMIC_ACQUIRE)) & 1)
+			;
+		mono = p->mono_ns;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (__atomic_load_n(&p->seq, __ATOMIC_RELAXED) != seq);
+	return mono;
+}
+
+static void report(const char *name, long iters, int64_t elapsed) {
+	printf("%-22s %10ld samples %10.1f ns/sample\n", name, iters, (double)elapsed / iters);
+}
+
+static void bench_proc_open(long iters) {
+	char buf[512];
+	int64_t start = now_ns();
+	long i;
+
+	for (i = 0; i < iters; i++) {
+		int fd = open(TIMER_PROC, O_RDONLY);
+
+		if (fd < 0) {
+			perror("open " TIMER_PROC);
+			return;
+		}
+		if (read(fd, buf, sizeof(buf)) < 0)
+			perror("read");
+		close(fd);
+	}
+	report("proc open+read+close", iters, now_ns() - start);
+}
+
+static void bench_proc_pread(long iters) {
+	char buf[512];
+	int64_t start;
+	long i;
+	int fd = open(TIMER_PROC, O_RDONLY);
+
+	if (fd < 0) {
+		perror("open " TIMER_PROC);
+		return;
+	}
+	start = now_ns();
+	for (i = 0; i < iters; i++)
+		if (pread(fd, buf, sizeof(buf), 0) < 0)
+			perror("pread");
+	report("proc pread", iters, now_ns() - start);
+	close(fd);
+}
+
+static void bench_vdso(long iters) {
+	struct timespec ts;
+	int64_t start = now_ns();
+	long i;
+
+	for (i = 0; i < iters; i++)
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+	report("clock_gettime (vDSO)", iters, now_ns() - start);
+}
+
+static void bench_page(long iters) {
+	const volatile struct my_timer_page *p;
+	int64_t start, lag = 0;
+	long i;
+	int fd = open(TIMER_PROC, O_RDONLY);
+
+	if (fd < 0) {
+		perror("open " TIMER_PROC);
+		return;
+	}
+	p = mmap(NULL, 4096, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		perror("mmap " TIMER_PROC);
+		return;
+	}
+
+	start = now_ns();
+	for (i = 0; i < iters; i++)
+		page_mono_ns(p);
+	report("mapped page", iters, now_ns() - start);
+
+	/* How far behind CLOCK_MONOTONIC the page is, on average. */
+	for (i = 0; i < 1000; i++)
+		lag += now_ns() - page_mono_ns(p);
+	printf("mapped page: period %u ns, %llu updates, mean lag %.1f us\n", p->period_ns,
+	       (unsigned long long)p->updates, lag / 1000.0 / 1000);
+
+	munmap((void *)p, 4096);
+}
+
+int main(int argc, char **argv) {
+	long iters = 1000000;
+
+	if (argc > 2) {
+		printf("wrong number of args. timer_bench [iterations]\n");
+		return -1;
+	}
+	if (argc == 2)
+		iters = atol(argv[1]);
+	if (iters < 1)
+		return -1;
+
+	/* open+read+close is orders of magnitude slower; keep it short. */
+	bench_proc_open(iters / 100 > 0 ? iters / 100 : 1);
+	bench_proc_pread(iters / 10 > 0 ? iters / 10 : 1);
+	bench_vdso(iters);
+	bench_page(iters);
+	return 0;
+}
@@ -5,9 +5,23 @@
 #include <linux/uaccess.h>
 #include <linux/ktime.h>
 #include <linux/list.h>
-#include <linux/kthread.h>
-#include <linux/delay.h>
+#include <linux/workqueue.h>
+#include <linux/debugfs.h>
+#include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/wait.h>
+#include <linux/moduleparam.h>
+#include <linux/mm.h>
+#include <linux/crc32.h>
+#include <linux/rcupdate.h>
+#include <linux/kref.h>
+#include <linux/atomic.h>
+#include <linux/miscdevice.h>
+#include <linux/fs.h>
+#include <net/genetlink.h>
+
+#include "elevator_uapi.h"
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Group #");
@@ -15,8 +29,13 @@ MODULE_DESCRIPTION("Elevator Module");
 MODULE_VERSION("1.0");
 
 #define ENTRY_NAME "elevator"
+#define STATS_ENTRY_NAME "elevator_stats"
+#define BIN_ENTRY_NAME "elevator_bin"
+#define JSON_ENTRY_NAME "elevator_json"
+#define CHECKPOINT_ENTRY_NAME "elevator_checkpoint"
 #define PERMS 0644
 #define PARENT NULL
+#define CHECKPOINT_PERMS 0600
 
 #define NUM_FLOORS 5
 #define MAX_LOAD 700
@@ -26,6 +45,58 @@ MODULE_VERSION("1.0");
 #define BOSS 2
 #define VISITOR 3
 
+// Boarding priority classes, higher boards first
+#define NUM_PRIORITIES 3
+#define PRIO_LOW 0
+#define PRIO_NORMAL 1
+#define PRIO_HIGH 2
+
+// An explicit priority is passed as (priority + 1) in the type bits above this shift
+#define PRIORITY_SHIFT 8
+
+// Wait-time histogram: bucket b holds waits below 2^b ms
+#define WAIT_BUCKETS 20
+
+// Demand estimates: thousandths of an arrival per second, newest second weighted 1/64
+#define DIR_UP 0
+#define DIR_DOWN 1
+#define DEMAND_SCALE 1000
+#define DEMAND_EWMA_SHIFT 6
+
+// Car timing: idle re-check, doors open per passenger, travel per floor
+#define CAR_IDLE_MS 1000
+#define CAR_DWELL_MS 1000
+#define CAR_FLOOR_MS 2000
+
+// Fair queuing: weight a submitter may board per round, at least the heaviest passenger
+#define DRR_QUANTUM 20
+// Idle submitters whose wait stats are kept
+#define MAX_SUBMITTERS 64
+
+// ETA queries: predictions kept for matching with the request that follows them
+#define ETA_RECORDS 64
+#define ETA_MATCH_NS (10 * NSEC_PER_SEC)
+#define ETA_MAX_STEPS 65536
+
+// Car step cost is kept per log2 bucket of the number of waiting passengers
+#define STEP_DEPTHS 10
+
+// Lock histograms: bucket b holds times below 2^b us
+#define LOCK_BUCKETS 20
+// Widest lock_stats line, and widest " <N:count" histogram entry
+#define LOCK_LINE_MAX 128
+#define LOCK_ENTRY_MAX 32
+
+// Requests copied in per step of an ELEVATOR_IOC_BATCH
+#define BATCH_CHUNK 16
+
+// Checkpoint format, see struct checkpoint_header
+#define CHECKPOINT_MAGIC 0x56454c45
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_MAX_SIZE (16 << 20)
+#define CHECKPOINT_ON_BOARD 0x1
+#define CHECKPOINT_IDLE_ARRIVAL 0x2
+
 #define OFFLINE OFFLINE
 #define IDLE IDLE
 #define LOADING LOADING
@@ -35,34 +106,83 @@ MODULE_VERSION("1.0");
 int start_elevator(void);                                                          
 int issue_request(int start_floor, int destination_floor, int type);               
 int stop_elevator(void); 
-void moveElevator(void);
+int elevator_eta(struct elevator_eta __user *eta);
 
-extern int (*STUB_start_elevator)(void);
-extern int (*STUB_issue_request)(int,int,int);
-extern int (*STUB_stop_elevator)(void);
+// Provided by kernels patched with the elevator syscalls, looked up with symbol_get()
+extern int elevator_syscalls_register(int (*start)(void), int (*issue)(int,int,int), int (*stop)(void),
+                                      int (*eta)(struct elevator_eta __user *));
+extern void elevator_syscalls_unregister(void);
 
 enum Elevator_state {OFFLINE, IDLE, LOADING, UP, DOWN};
 
+/*
+ * What the car is doing between two runs of elevator.work. Every phase ends
+ * when the work item fires; each step runs briefly under elevator.mutex and
+ * never sleeps, so requests and readers do not wait behind a moving car.
+ */
+enum car_phase {
+    CAR_IDLE,        // nothing to do, re-checked every CAR_IDLE_MS or when kicked
+    CAR_ARRIVED,     // stopped at current_floor, decide what to do next
+    CAR_DOOR_DWELL,  // doors open, one passenger gets on or off when it ends
+    CAR_MOVING,      // travelling one floor towards current_destination
+};
+
 struct Elevator{
     enum Elevator_state state;
+    enum car_phase phase;
     int current_load, current_floor, current_destination;
     struct list_head passengers_on_board;
-    struct task_struct *kthread;
+    struct delayed_work work;
     struct mutex mutex;
 };
 
+/*
+ * A submitting process (thread group). Each floor boards submitters with
+ * waiting passengers in deficit round-robin order, so a process flooding a
+ * floor only gets its share of each round.
+ */
+struct submitter {
+    pid_t tgid;
+    char comm[TASK_COMM_LEN];
+    // Waiting plus riding, capped by max_outstanding_per_process
+    int outstanding;
+    int waiting[NUM_FLOORS];
+    int deficit[NUM_FLOORS];
+    // In the middle of its turn at the head of the floor's round
+    bool turn[NUM_FLOORS];
+    struct list_head rr[NUM_FLOORS];
+    // This submitter's waiting passengers, per floor and class, oldest first
+    struct list_head queue[NUM_FLOORS][NUM_PRIORITIES];
+    unsigned long wait_hist[WAIT_BUCKETS];
+    unsigned long wait_count;
+    u64 wait_max_ms;
+    // All submitters, most recently used first
+    struct list_head list;
+};
+
 typedef struct passenger{
-    int destination, weight, start;
+    int destination, weight, start, type;
+    struct submitter *submitter;
+    int priority;
+    bool idle_arrival;
+    u64 enqueued_ns;
+    // Prediction from an ETA query made just before the request, see eta_claim()
+    bool has_eta;
+    u32 eta_wait_ms, eta_ride_ms;
+    u64 boarded_ns;
     struct list_head list;
-    char str[2];
+    // Link in submitter->queue while waiting
+    struct list_head sub_list;
+    char str[3];
 } Passenger;
 
 struct Floor{
     int num_waiting_floor;
-    struct list_head passengers_waiting;
+    struct list_head passengers_waiting[NUM_PRIORITIES];
+    // Submitters with passengers waiting here, in round-robin order
+    struct list_head rr;
 };
 
-void getNewDestination(void);
 void service_floor(void);
 static ssize_t elevator_read(struct file *file, char __user *ubuf, size_t count, loff_t *ppos);
 
@@ -76,104 +196,828 @@ static int num_waiting;
 static int num_serviced;
 
 static bool turn_off;
+// Set by reading /proc/elevator_checkpoint: the car is stopped and nothing changes until unload
+static bool frozen;
+
+// Admission control: caps on waiting passengers, 0 means unlimited
+static int max_waiting_per_floor = 64;
+module_param(max_waiting_per_floor, int, 0644);
+MODULE_PARM_DESC(max_waiting_per_floor, "Maximum passengers waiting on a single floor (0 = unlimited)");
+
+static int max_waiting_total = 256;
+module_param(max_waiting_total, int, 0644);
+MODULE_PARM_DESC(max_waiting_total, "Maximum passengers waiting across all floors (0 = unlimited)");
+
+static bool admission_block;
+module_param(admission_block, bool, 0644);
+MODULE_PARM_DESC(admission_block, "Block issue_request until there is room instead of returning -EAGAIN");
+
+static DECLARE_WAIT_QUEUE_HEAD(admission_wq);
+
+static bool fair_queuing = true;
+module_param(fair_queuing, bool, 0644);
+MODULE_PARM_DESC(fair_queuing, "Board each floor's submitters in deficit round-robin order instead of oldest first");
+
+static int max_outstanding_per_process;
+module_param(max_outstanding_per_process, int, 0644);
+MODULE_PARM_DESC(max_outstanding_per_process, "Maximum waiting or riding passengers per process (0 = unlimited)");
+
+static LIST_HEAD(submitters);
+static int num_submitters;
+static unsigned long num_quota_rejected;
+
+// Crossing this many passengers waiting on a floor, either way, raises an event
+static int queue_depth_threshold = 10;
+module_param(queue_depth_threshold, int, 0644);
+MODULE_PARM_DESC(queue_depth_threshold, "Floor queue depth that triggers a netlink event (0 = off)");
+
+static unsigned long num_admitted;
+static unsigned long num_rejected;
+static unsigned long num_blocked;
+
+static struct proc_dir_entry* stats_entry;
+static struct proc_dir_entry* checkpoint_entry;
+static struct proc_dir_entry* bin_entry;
+static struct proc_dir_entry* json_entry;
+
+// Indexed by passenger type
+static const char type_initials[] = "PLBV";
+static const int type_weights[] = {10, 15, 20, 5};
+static const int type_priorities[] = {PRIO_NORMAL, PRIO_NORMAL, PRIO_HIGH, PRIO_LOW};
+
+/*
+ * Immutable copy of what /proc/elevator shows. A new one is published under
+ * elevator.mutex after every state change; readers only take a reference under
+ * rcu_read_lock(), so they never contend with the car. The last reference
+ * frees it after a grace period.
+ */
+struct rendered_text {
+    size_t len;
+    char text[];
+};
+
+struct snapshot_passenger {
+    u8 type, start, destination, priority;
+    u64 enqueued_ns;
+};
+
+struct elevator_snapshot {
+    struct kref ref;
+    struct rcu_head rcu;
+    // Bumped only when the visible state changes
+    u64 generation;
+    // Rendered /proc/elevator text, installed once by the first reader
+    struct rendered_text *rendered;
+    enum Elevator_state state;
+    int current_floor, current_load, current_destination, direction;
+    bool turn_off;
+    int num_passengers, num_waiting, num_serviced;
+    // Riders are passengers[0, floor_start[0]), floor i is [floor_start[i], floor_start[i+1])
+    int floor_start[NUM_FLOORS + 1];
+    struct snapshot_passenger passengers[];
+};
+
+static struct elevator_snapshot __rcu *elevator_snap;
+static u64 state_generation;
+// Set by car steps that change what the snapshot shows, so idle steps skip building one
+static bool snapshot_stale;
+
+static atomic_long_t render_hits = ATOMIC_LONG_INIT(0);
+static atomic_long_t render_misses = ATOMIC_LONG_INIT(0);
+static atomic64_t render_ns = ATOMIC64_INIT(0);
+
+// Each aging_ms spent waiting raises a passenger's effective priority by one class
+static int aging_ms = 10000;
+module_param(aging_ms, int, 0644);
+MODULE_PARM_DESC(aging_ms, "Milliseconds of waiting per priority boost (0 = no aging)");
+
+static const char *priority_names[NUM_PRIORITIES] = {"LOW", "NORMAL", "HIGH"};
+
+static unsigned long wait_hist[NUM_PRIORITIES][WAIT_BUCKETS];
+static unsigned long wait_count[NUM_PRIORITIES];
+static u64 wait_max_ms[NUM_PRIORITIES];
+
+// Idle parking: move an idle car to the floor with the lowest expected pickup distance
+static bool idle_parking = true;
+module_param(idle_parking, bool, 0644);
+MODULE_PARM_DESC(idle_parking, "Park the idle car at the floor that minimizes expected response time");
+
+static unsigned long floor_arrivals[NUM_FLOORS][2];
+static unsigned long floor_demand[NUM_FLOORS][2];
+static u64 demand_updated_ns;
+static unsigned long num_park_moves;
+static unsigned long idle_pickup_count;
+static u64 idle_pickup_total_ms;
+
+/*
+ * Contention and hold-time stats for elevator.mutex, per call site, shown in
+ * /sys/kernel/debug/elevator/lock_stats. An uncontended acquisition costs a
+ * trylock and two clock reads; only a failed trylock times the wait. Stats are
+ * updated with the mutex held, so they need no atomics of their own.
+ */
+enum lock_site {LOCK_START, LOCK_ISSUE, LOCK_STOP, LOCK_CAR, LOCK_STATS, LOCK_CHECKPOINT, NUM_LOCK_SITES};
+
+static const char *lock_site_names[NUM_LOCK_SITES] = {"start", "issue", "stop", "car", "stats", "checkpoint"};
+
+struct lock_site_stats {
+    unsigned long acquired, contended;
+    u64 wait_ns, wait_max_ns, hold_ns, hold_max_ns;
+    unsigned long wait_hist[LOCK_BUCKETS];
+    unsigned long hold_hist[LOCK_BUCKETS];
+};
+
+static bool lock_stats = true;
+module_param(lock_stats, bool, 0644);
+MODULE_PARM_DESC(lock_stats, "Record elevator lock contention and hold times");
+
+static struct lock_site_stats lock_site_stats[NUM_LOCK_SITES];
+static struct dentry *debugfs_dir;
+
+// Owner of the current hold, valid while elevator.mutex is held
+static int lock_holder = -1;
+static u64 lock_acquired_ns;
+
+static void lock_hist_add(unsigned long *hist, u64 ns){
+    hist[min_t(int, fls64(div_u64(ns, NSEC_PER_USEC)), LOCK_BUCKETS - 1)]++;
+}
+
+static void elevator_lock(enum lock_site site){
+    struct lock_site_stats *ls = &lock_site_stats[site];
+    u64 start;
+
+    if(!READ_ONCE(lock_stats)){
+        mutex_lock(&elevator.mutex);
+        lock_holder = -1;
+        return;
+    }
+
+    if(mutex_trylock(&elevator.mutex)){
+        lock_acquired_ns = ktime_get_ns();
+    }
+    else{
+        start = ktime_get_ns();
+        mutex_lock(&elevator.mutex);
+        lock_acquired_ns = ktime_get_ns();
+        ls->contended++;
+        ls->wait_ns += lock_acquired_ns - start;
+        ls->wait_max_ns = max(ls->wait_max_ns, lock_acquired_ns - start);
+        lock_hist_add(ls->wait_hist, lock_acquired_ns - start);
+    }
+    ls->acquired++;
+    lock_holder = site;
+}
+
+static void elevator_unlock(void){
+    if(lock_holder >= 0){
+        struct lock_site_stats *ls = &lock_site_stats[lock_holder];
+        u64 held = ktime_get_ns() - lock_acquired_ns;
+
+        ls->hold_ns += held;
+        ls->hold_max_ns = max(ls->hold_max_ns, held);
+        lock_hist_add(ls->hold_hist, held);
+        lock_holder = -1;
+    }
+    mutex_unlock(&elevator.mutex);
+}
+
+/*
+ * ETA predictions are remembered briefly; a matching request from the same
+ * process takes its prediction along, and boarding and arrival compare it
+ * with what actually happened.
+ */
+struct eta_record {
+    pid_t tgid;
+    u8 start, destination, type, priority;
+    u32 wait_ms, ride_ms;
+    u64 at_ns;
+};
+
+// Absolute prediction errors, bucket b below 2^b ms, plus the signed sum for the bias
+struct eta_error {
+    unsigned long hist[WAIT_BUCKETS];
+    unsigned long count;
+    s64 bias_ms;
+    u64 max_ms;
+};
+
+static struct eta_record eta_records[ETA_RECORDS];
+static unsigned int eta_next;
+static DEFINE_SPINLOCK(eta_lock);
+static atomic_long_t eta_queries = ATOMIC_LONG_INIT(0);
+static unsigned long eta_matched;
+static struct eta_error eta_wait_error, eta_ride_error;
+
+// Take the newest unexpired prediction this process made for the same trip. Called with elevator.mutex held.
+static void eta_claim(Passenger *p){
+    pid_t tgid = task_tgid_nr(current);
+    u64 now = ktime_get_ns();
+
+    spin_lock(&eta_lock);
+    for(unsigned int i = 1; i <= ETA_RECORDS; i++){
+        struct eta_record *rec = &eta_records[(eta_next - i) % ETA_RECORDS];
+
+        if(rec->tgid != tgid || now - rec->at_ns > ETA_MATCH_NS || rec->start != p->start ||
+           rec->destination != p->destination || rec->type != p->type || rec->priority != p->priority)
+            continue;
+        p->has_eta = true;
+        p->eta_wait_ms = rec->wait_ms;
+        p->eta_ride_ms = rec->ride_ms;
+        rec->tgid = 0;
+        eta_matched++;
+        break;
+    }
+    spin_unlock(&eta_lock);
+}
+
+// Called with elevator.mutex held
+static void eta_record_error(struct eta_error *err, u64 actual_ns, u32 predicted_ms){
+    s64 diff = (s64)div_u64(actual_ns, NSEC_PER_MSEC) - predicted_ms;
+    u64 ms = abs(diff);
+
+    err->hist[min_t(int, fls64(ms), WAIT_BUCKETS - 1)]++;
+    err->count++;
+    err->bias_ms += diff;
+    err->max_ms = max(err->max_ms, ms);
+}
+
+// Called with elevator.mutex held, or locklessly as a wait condition
+static bool queue_has_room(int floor){
+    if(max_waiting_total > 0 && num_waiting >= max_waiting_total)
+        return false;
+    if(max_waiting_per_floor > 0 && floors[floor].num_waiting_floor >= max_waiting_per_floor)
+        return false;
+    return true;
+}
+
+static bool elevator_closed(void){
+    return turn_off || frozen || elevator.state == OFFLINE;
+}
+
+static int effective_priority(Passenger *p, u64 now){
+    u64 boost = 0;
+
+    if(aging_ms > 0)
+        boost = div64_u64(now - p->enqueued_ns, (u64)aging_ms * NSEC_PER_MSEC);
+    return p->priority + (int)min_t(u64, boost, NUM_PRIORITIES - 1);
+}
+
+// Oldest passenger of a submitter (any with NULL) on a floor at effective priority prio.
+// Each class is FIFO, so only the head of each class queue is a candidate.
+static Passenger *oldest_waiting(int floor, struct submitter *sub, int prio, u64 now){
+    Passenger *best = NULL;
+
+    for(int i = NUM_PRIORITIES - 1; i >= 0; i--){
+        Passenger *p;
+
+        if(sub)
+            p = list_first_entry_or_null(&sub->queue[floor][i], Passenger, sub_list);
+        else
+            p = list_first_entry_or_null(&floors[floor].passengers_waiting[i], Passenger, list);
+        if(p && effective_priority(p, now) == prio && (!best || p->enqueued_ns < best->enqueued_ns))
+            best = p;
+    }
+    return best;
+}
+
+// Next passenger to board on a floor. Highest effective priority first; within it,
+// the submitter whose round-robin turn it is, or simply the oldest without fair queuing.
+// Does not change any state, see drr_charge() for that.
+static Passenger *next_waiting(int floor){
+    struct submitter *sub;
+    Passenger *p;
+    int best_prio = -1;
+    u64 now = ktime_get_ns();
+
+    for(int i = NUM_PRIORITIES - 1; i >= 0; i--){
+        if(!list_empty(&floors[floor].passengers_waiting[i]))
+            best_prio = max(best_prio, effective_priority(list_first_entry(&floors[floor].passengers_waiting[i], Passenger, list), now));
+    }
+    if(best_prio < 0)
+        return NULL;
+    if(!fair_queuing)
+        return oldest_waiting(floor, NULL, best_prio, now);
+
+    // The head keeps its turn while its deficit covers its next passenger; anyone
+    // else gets a fresh DRR_QUANTUM first, which always covers one passenger.
+    list_for_each_entry(sub, &floors[floor].rr, rr[floor]){
+        p = oldest_waiting(floor, sub, best_prio, now);
+        if(!p)
+            continue;
+        if(!sub->turn[floor] || sub->deficit[floor] >= p->weight)
+            return p;
+    }
+
+    // Only the head has a candidate and its turn is used up: it starts a new one
+    return oldest_waiting(floor, NULL, best_prio, now);
+}
+
+// Charge a boarding passenger to its submitter's turn, ending the turns it skipped over
+static void drr_charge(int floor, Passenger *p){
+    struct submitter *sub = p->submitter;
+    struct submitter *head;
+
+    for(;;){
+        head = list_first_entry(&floors[floor].rr, struct submitter, rr[floor]);
+        if(head == sub && (!sub->turn[floor] || sub->deficit[floor] >= p->weight))
+            break;
+        head->turn[floor] = false;
+        list_move_tail(&head->rr[floor], &floors[floor].rr);
+    }
+    if(!sub->turn[floor]){
+        sub->deficit[floor] += DRR_QUANTUM;
+        sub->turn[floor] = true;
+    }
+    sub->deficit[floor] -= p->weight;
+
+    if(--sub->waiting[floor] == 0){
+        list_del_init(&sub->rr[floor]);
+        sub->deficit[floor] = 0;
+        sub->turn[floor] = false;
+    }
+}
+
+static void record_wait(Passenger *p){
+    u64 ms = div_u64(ktime_get_ns() - p->enqueued_ns, NSEC_PER_MSEC);
+    int bucket = min_t(int, fls64(ms), WAIT_BUCKETS - 1);
+
+    wait_hist[p->priority][bucket]++;
+    wait_count[p->priority]++;
+    if(ms > wait_max_ms[p->priority])
+        wait_max_ms[p->priority] = ms;
+
+    p->submitter->wait_hist[bucket]++;
+    p->submitter->wait_count++;
+    if(ms > p->submitter->wait_max_ms)
+        p->submitter->wait_max_ms = ms;
+
+    if(p->idle_arrival){
+        idle_pickup_count++;
+        idle_pickup_total_ms += ms;
+    }
+}
+
+// Fold arrivals seen since the last update into the per-floor EWMAs, one step per second
+static void update_demand(void){
+    u64 now = ktime_get_ns();
+    u64 secs = div64_u64(now - demand_updated_ns, NSEC_PER_SEC);
+
+    if(secs == 0)
+        return;
+    if(secs > 8 << DEMAND_EWMA_SHIFT){
+        secs = 8 << DEMAND_EWMA_SHIFT;
+        demand_updated_ns = now;
+    }
+    else
+        demand_updated_ns += secs * NSEC_PER_SEC;
+
+    for(int i = 0; i < NUM_FLOORS; i++){
+        for(int dir = DIR_UP; dir <= DIR_DOWN; dir++){
+            unsigned long rate = floor_demand[i][dir];
+
+            rate = rate - (rate >> DEMAND_EWMA_SHIFT) + ((floor_arrivals[i][dir] * DEMAND_SCALE) >> DEMAND_EWMA_SHIFT);
+            for(u64 step = 1; step < secs; step++)
+                rate -= rate >> DEMAND_EWMA_SHIFT;
+
+            floor_demand[i][dir] = rate;
+            floor_arrivals[i][dir] = 0;
+        }
+    }
+}
+
+// Floor minimizing the demand-weighted travel distance to the next pickup
+static int best_park_floor(void){
+    int best = elevator.current_floor;
+    u64 best_cost = U64_MAX;
+
+    for(int f = 0; f < NUM_FLOORS; f++){
+        u64 cost = 0;
+
+        for(int g = 0; g < NUM_FLOORS; g++)
+            cost += (u64)(floor_demand[g][DIR_UP] + floor_demand[g][DIR_DOWN]) * abs(f - g);
+
+        if(cost < best_cost || (cost == best_cost &&
+           abs(f - elevator.current_floor) < abs(best - elevator.current_floor))){
+            best = f;
+            best_cost = cost;
+        }
+    }
+    return best;
+}
+
+// Upper bound of the bucket holding the pct-th percentile of a log2 histogram of n samples
+static u64 hist_percentile(const unsigned long *hist, int buckets, unsigned long n, int pct){
+    unsigned long target, seen = 0;
+
+    if(n == 0)
+        return 0;
+    target = DIV_ROUND_UP(n * pct, 100);
+    for(int b = 0; b < buckets; b++){
+        seen += hist[b];
+        if(seen >= target)
+            return 1ULL << b;
+    }
+    return 1ULL << (buckets - 1);
+}
+
+// Submitter of the calling process, created on first use. Called with elevator.mutex held.
+static struct submitter *submitter_get(pid_t tgid){
+    struct submitter *sub, *old, *tmp;
+
+    list_for_each_entry(sub, &submitters, list){
+        if(sub->tgid == tgid){
+            list_move(&sub->list, &submitters);
+            return sub;
+        }
+    }
+
+    sub = kzalloc(sizeof(*sub), GFP_KERNEL);
+    if(!sub)
+        return NULL;
+    sub->tgid = tgid;
+    if(tgid == 0)
+        strscpy(sub->comm, "restored", sizeof(sub->comm));
+    else
+        get_task_comm(sub->comm, current->group_leader);
+    for(int i = 0; i < NUM_FLOORS; i++){
+        INIT_LIST_HEAD(&sub->rr[i]);
+        for(int prio = 0; prio < NUM_PRIORITIES; prio++)
+            INIT_LIST_HEAD(&sub->queue[i][prio]);
+    }
+    list_add(&sub->list, &submitters);
+    num_submitters++;
+
+    // Forget the least recently used idle submitters beyond MAX_SUBMITTERS
+    list_for_each_entry_safe_reverse(old, tmp, &submitters, list){
+        if(num_submitters <= MAX_SUBMITTERS)
+            break;
+        if(old != sub && old->outstanding == 0){
+            list_del(&old->list);
+            kfree(old);
+            num_submitters--;
+        }
+    }
+    return sub;
+}
+
+/*
+ * Stop plan: the floors the car still has to visit, kept as bitmasks that are
+ * updated as passengers queue, board and get off, so the car reads its next
+ * stop in O(1). The plan is served in elevator order (LOOK): the nearest stop
+ * ahead in plan_direction, turning around only when there is none left.
+ */
+static int riders_to[NUM_FLOORS];
+static unsigned int rider_stops, waiting_stops;
+static int plan_direction = DIR_UP;
+
+static unsigned long step_count[STEP_DEPTHS];
+static u64 step_ns[STEP_DEPTHS], step_max_ns[STEP_DEPTHS];
+
+static void plan_add_rider(Passenger *p){
+    if(riders_to[p->destination]++ == 0)
+        rider_stops |= 1U << p->destination;
+}
+
+static void plan_remove_rider(Passenger *p){
+    if(--riders_to[p->destination] == 0)
+        rider_stops &= ~(1U << p->destination);
+}
+
+// Floors worth stopping at apart from the current one: waiting floors only while someone can board
+static unsigned int plan_stops(void){
+    unsigned int stops = rider_stops;
+
+    if(!turn_off && num_passengers < MAX_PASSENGERS)
+        stops |= waiting_stops;
+    return stops & ~(1U << elevator.current_floor);
+}
+
+// Next floor to head for, or -1 when the plan is empty
+static int plan_head(void){
+    unsigned int stops = plan_stops();
+    unsigned int above = stops & ~((2U << elevator.current_floor) - 1);
+    unsigned int below = stops & ((1U << elevator.current_floor) - 1);
+
+    if(plan_direction == DIR_UP)
+        return above ? __ffs(above) : below ? __fls(below) : -1;
+    return below ? __fls(below) : above ? __ffs(above) : -1;
+}
+
+// Queue a passenger on its start floor. Called with elevator.mutex held.
+static void enqueue_waiting(Passenger *p){
+    struct submitter *sub = p->submitter;
+
+    list_add_tail(&p->list, &floors[p->start].passengers_waiting[p->priority]);
+    list_add_tail(&p->sub_list, &sub->queue[p->start][p->priority]);
+    waiting_stops |= 1U << p->start;
+    floors[p->start].num_waiting_floor++;
+    num_waiting++;
+    sub->outstanding++;
+    if(sub->waiting[p->start]++ == 0)
+        list_add_tail(&sub->rr[p->start], &floors[p->start].rr);
+}
+
+static void snapshot_release(struct kref *ref){
+    struct elevator_snapshot *snap = container_of(ref, struct elevator_snapshot, ref);
+
+    // RCU readers that can still see snap only touch snap->ref
+    kvfree(snap->rendered);
+    kfree_rcu(snap, rcu);
+}
+
+static size_t snapshot_add_passengers(struct snapshot_passenger *dst, size_t len, size_t cap, struct list_head *list){
+    Passenger *p;
+
+    list_for_each_entry(p, list, list){
+        if(len == cap)
+            break;
+        dst[len].type = p->type;
+        dst[len].start = p->start;
+        dst[len].destination = p->destination;
+        dst[len].priority = p->priority;
+        dst[len].enqueued_ns = p->enqueued_ns;
+        len++;
+    }
+    return len;
+}
+
+static bool snapshot_same(const struct elevator_snapshot *a, const struct elevator_snapshot *b){
+    return a->state == b->state && a->current_floor == b->current_floor &&
+           a->current_destination == b->current_destination && a->direction == b->direction &&
+           a->turn_off == b->turn_off &&
+           a->current_load == b->current_load && a->num_passengers == b->num_passengers &&
+           a->num_waiting == b->num_waiting && a->num_serviced == b->num_serviced &&
+           !memcmp(a->floor_start, b->floor_start, sizeof(a->floor_start)) &&
+           !memcmp(a->passengers, b->passengers, a->floor_start[NUM_FLOORS] * sizeof(a->passengers[0]));
+}
+
+// Called with elevator.mutex held after every change that /proc/elevator can see
+static void publish_snapshot(void){
+    struct elevator_snapshot *snap, *old;
+    size_t cap = num_passengers + num_waiting;
+    size_t len;
+
+    snapshot_stale = false;
+
+    // Zeroed so records can be compared with memcmp
+    snap = kzalloc(sizeof(*snap) + cap * sizeof(snap->passengers[0]), GFP_KERNEL);
+    if(!snap)
+        return; // readers keep seeing the previous, still consistent, snapshot
+
+    kref_init(&snap->ref);
+    snap->rendered = NULL;
+    snap->state = elevator.state;
+    snap->current_floor = elevator.current_floor;
+    snap->current_load = elevator.current_load;
+    snap->current_destination = elevator.current_destination;
+    snap->direction = plan_direction;
+    snap->turn_off = turn_off;
+    snap->num_passengers = num_passengers;
+    snap->num_waiting = num_waiting;
+    snap->num_serviced = num_serviced;
+
+    len = snapshot_add_passengers(snap->passengers, 0, cap, &elevator.passengers_on_board);
+    for(int i = 0; i < NUM_FLOORS; i++){
+        snap->floor_start[i] = len;
+        for(int prio = NUM_PRIORITIES - 1; prio >= 0; prio--)
+            len = snapshot_add_passengers(snap->passengers, len, cap, &floors[i].passengers_waiting[prio]);
+    }
+    snap->floor_start[NUM_FLOORS] = len;
+
+    old = rcu_dereference_protected(elevator_snap, lockdep_is_held(&elevator.mutex));
+    if(old && snapshot_same(old, snap)){
+        // Nothing visible changed, keep the old snapshot and its rendered text
+        kfree(snap);
+        return;
+    }
+    snap->generation = ++state_generation;
+    rcu_assign_pointer(elevator_snap, snap);
+    if(old)
+        kref_put(&old->ref, snapshot_release);
+}
+
+static struct elevator_snapshot *snapshot_get(void){
+    struct elevator_snapshot *snap;
+
+    rcu_read_lock();
+    snap = rcu_dereference(elevator_snap);
+    if(snap && !kref_get_unless_zero(&snap->ref))
+        snap = NULL;
+    rcu_read_unlock();
+    return snap;
+}
+
+static void snapshot_put(struct elevator_snapshot *snap){
+    kref_put(&snap->ref, snapshot_release);
+}
+
+/*
+ * State-change events, multicast over generic netlink so subscribers are
+ * pushed each event as it happens instead of polling /proc/elevator.
+ */
+static const struct genl_multicast_group elevator_genl_mcgrps[] = {
+    { .name = ELEVATOR_GENL_MCGRP },
+};
+
+static struct genl_family elevator_genl_family = {
+    .module = THIS_MODULE,
+    .name = ELEVATOR_GENL_NAME,
+    .version = ELEVATOR_GENL_VERSION,
+    .maxattr = ELEVATOR_ATTR_MAX,
+    .mcgrps = elevator_genl_mcgrps,
+    .n_mcgrps = ARRAY_SIZE(elevator_genl_mcgrps),
+};
+
+static void elevator_notify(u32 type, int floor, const Passenger *p, int queue_depth){
+    struct elevator_event *ev;
+    struct sk_buff *skb;
+    struct nlattr *attr;
+    void *hdr;
+
+    if(!genl_has_listeners(&elevator_genl_family, &init_net, 0))
+        return;
+
+    skb = genlmsg_new(nla_total_size(sizeof(*ev)), GFP_KERNEL);
+    if(!skb)
+        return;
+    hdr = genlmsg_put(skb, 0, 0, &elevator_genl_family, 0, ELEVATOR_CMD_EVENT);
+    attr = hdr ? nla_reserve(skb, ELEVATOR_ATTR_EVENT, sizeof(*ev)) : NULL;
+    if(!attr){
+        nlmsg_free(skb);
+        return;
+    }
+
+    ev = nla_data(attr);
+    ev->type = type;
+    ev->state = elevator.state;
+    ev->floor = floor + 1;
+    ev->passenger_type = p ? p->type : 0;
+    ev->destination = p ? p->destination + 1 : 0;
+    ev->queue_depth = queue_depth;
+    ev->timestamp_ns = ktime_get_ns();
+
+    genlmsg_end(skb, hdr);
+    genlmsg_multicast(&elevator_genl_family, skb, 0, 0, GFP_KERNEL);
+}
+
+static void set_state(enum Elevator_state state){
+    if(elevator.state == state)
+        return;
+    elevator.state = state;
+    snapshot_stale = true;
+    elevator_notify(ELEVATOR_EVENT_STATE, elevator.current_floor, NULL, 0);
+}
+
+// Raise an event when a floor queue moved across queue_depth_threshold
+static void notify_queue_depth(int floor, int before){
+    int after = floors[floor].num_waiting_floor;
+
+    if(queue_depth_threshold > 0 && (before < queue_depth_threshold) != (after < queue_depth_threshold))
+        elevator_notify(ELEVATOR_EVENT_QUEUE_DEPTH, floor, NULL, after);
+}
+
+// Run the car now if it is waiting for work; a dwell or move in progress keeps its timer
+static void elevator_kick(void){
+    if(!frozen && elevator.state != OFFLINE && elevator.phase == CAR_IDLE)
+        mod_delayed_work(system_wq, &elevator.work, 0);
+}
 
 int start_elevator(void){
-    //mutex_lock(&elevator.mutex);
+    elevator_lock(LOCK_START);
+    if(frozen){
+        elevator_unlock();
+        return -EAGAIN;
+    }
     if(elevator.state != OFFLINE){
-        //mutex_lock(&elevator.mutex);
+        elevator_unlock();
         return 1;
     }
 
     elevator.current_floor = 1;
     elevator.current_load = 0;
-    elevator.state = IDLE;
+    elevator.phase = CAR_IDLE;
+    set_state(IDLE);
 
     turn_off = false;
-    //mutex_unlock(&elevator.mutex);
+    publish_snapshot();
+    elevator_kick();
+    elevator_unlock();
     return 0;
     // add -ERRORNUM and -ENOMEM
 }
 
 int issue_request(int start_floor, int destination_floor, int type){
-    printk(KERN_INFO "Inside Issue request");
-    //mutex_lock(&elevator.mutex);
-    /*if(turn_off || elevator.state == OFFLINE || start_floor < 1 || start_floor > NUM_FLOORS || destination_floor < 1 || destination_floor > NUM_FLOORS )
-        //mutex_unlock(&elevator.mutex);
-        printk(KERN_INFO "returning early");
+    int priority_arg = type >> PRIORITY_SHIFT;
+    type &= (1 << PRIORITY_SHIFT) - 1;
+    if(priority_arg < 0 || priority_arg > NUM_PRIORITIES)
+        return 1;
+    if(start_floor < 1 || start_floor > NUM_FLOORS || destination_floor < 1 || destination_floor > NUM_FLOORS)
         return 1;
-        */
-    
 
-    int weight;
-    char initial;
+    bool waited = false;
 
-    switch(type){
-        case PART_TIME:
-            weight = 10;
-            initial = 'P';
-            break;
-        case LAWYER:
-            weight = 15;
-            initial = 'L';
-            break;
-        case BOSS:
-            weight = 20;
-            initial = 'B';
-            break;
-        case VISITOR:
-            weight = 5;
-            initial = 'V';
-            break;
-        default:
-            return 1;
-    }
+    if(type < PART_TIME || type > VISITOR)
+        return 1;
 
     // Initialize passenger
     
     Passenger *passenger;
     
-    passenger = kmalloc(sizeof(Passenger), GFP_KERNEL);
+    // Charged to the memcg of the submitting process
+    passenger = kmalloc(sizeof(Passenger), GFP_KERNEL_ACCOUNT);
+    if(!passenger)
+        return -ENOMEM;
     
     passenger->start = start_floor - 1;
     passenger->destination = destination_floor - 1;
-    passenger->weight = weight;
+    passenger->weight = type_weights[type];
+    passenger->type = type;
+    passenger->priority = priority_arg ? priority_arg - 1 : type_priorities[type];
+    passenger->has_eta = false;
     
 
-    sprintf(passenger->str, "%c%d", initial, destination_floor);
-    
+    snprintf(passenger->str, sizeof(passenger->str), "%c%d", type_initials[type], destination_floor);
     
-    // Add passenger to floor list
-    
-    list_add_tail(&passenger->list, &floors[start_floor - 1].passengers_waiting);
-    printk(KERN_INFO "adding a new passenger");
-    num_waiting++;
+    elevator_lock(LOCK_ISSUE);
+
+    // Admission control: reject or wait while the floor or building is full
+    while(!elevator_closed() && !queue_has_room(start_floor - 1)){
+        if(!admission_block){
+            num_rejected++;
+            elevator_unlock();
+            kfree(passenger);
+            return -EAGAIN;
+        }
+        if(!waited){
+            num_blocked++;
+            waited = true;
+        }
+        elevator_unlock();
+        if(wait_event_interruptible(admission_wq, elevator_closed() || queue_has_room(start_floor - 1))){
+            kfree(passenger);
+            return -ERESTARTSYS;
+        }
+        elevator_lock(LOCK_ISSUE);
+    }
+
+    // Already in the checkpoint being exported, so this one would be lost
+    if(frozen){
+        elevator_unlock();
+        kfree(passenger);
+        return -EAGAIN;
+    }
+    if(elevator_closed()){
+        elevator_unlock();
+        kfree(passenger);
+        return 1;
+    }
+
+    passenger->submitter = submitter_get(task_tgid_nr(current));
+    if(!passenger->submitter){
+        elevator_unlock();
+        kfree(passenger);
+        return -ENOMEM;
+    }
+    // Per-process quota, failed right away so one tenant cannot hold up the others
+    if(max_outstanding_per_process > 0 && passenger->submitter->outstanding >= max_outstanding_per_process){
+        num_quota_rejected++;
+        elevator_unlock();
+        kfree(passenger);
+        return -EDQUOT;
+    }
 
-    //mutex_unlock(&elevator.mutex);
+    // Add passenger to the floor queue of its priority class
+    passenger->enqueued_ns = ktime_get_ns();
+    passenger->idle_arrival = num_waiting == 0 && num_passengers == 0;
+    floor_arrivals[start_floor - 1][destination_floor > start_floor ? DIR_UP : DIR_DOWN]++;
+    eta_claim(passenger);
+    enqueue_waiting(passenger);
+    notify_queue_depth(start_floor - 1, floors[start_floor - 1].num_waiting_floor - 1);
+    num_admitted++;
+
+    publish_snapshot();
+    elevator_kick();
+    elevator_unlock();
     return 0;
 }      
 
 int stop_elevator(void){
-    //mutex_lock(&elevator.mutex);
-    if(elevator.state == OFFLINE || turn_off)
-        //mutex_unlock(&elevator.mutex);
+    elevator_lock(LOCK_STOP);
+    if(frozen){
+        elevator_unlock();
+        return -EAGAIN;
+    }
+    if(elevator.state == OFFLINE || turn_off){
+        elevator_unlock();
         return 1;
+    }
     
     turn_off = true;
-    //mutex_unlock(&elevator.mutex);
-    return 0;
-}
-int stayOrMove(int curFloor){
-    struct list_head *temp;
-    struct list_head *dummy;
-    Passenger *p;
-    list_for_each_safe(temp, dummy, &elevator.passengers_on_board){
-        p = list_entry(temp, Passenger, list);
-        if(p!=NULL){
-            if(p->destination == curFloor){
-                return 1;
-            }
-        }
-    }
+    publish_snapshot();
+    elevator_kick();
+    elevator_unlock();
+
+    // Blocked submitters give up once the elevator is shutting down
+    wake_up_interruptible_all(&admission_wq);
     return 0;
 }
 /*
@@ -215,290 +1059,1436 @@ int elevator_run(void *data){
 
 
 
-int elevator_run(void *data){
-    while(!kthread_should_stop()){
-        //mutex_lock(&elevator.mutex);
-        if(elevator.state != OFFLINE){
-            if(num_waiting > 0){
-                printk(KERN_INFO "passengers waiting");
-                if(elevator.state == IDLE || stayOrMove(elevator.current_floor) == 0){
-                    printk(KERN_INFO "Getting new destination");
-                    getNewDestination();
-                }
-                service_floor();
-                printk(KERN_INFO "Getting new destination");
-                moveElevator();
-                printk(KERN_INFO "Getting new destination");
-            }
-            else{
-                if(turn_off){
-                    elevator.state = OFFLINE;
-                    printk(KERN_INFO "Going offline");
-                }
-                else{
-                    elevator.state = IDLE;
-                    printk(KERN_INFO "going idle");
-                }
-            }
-        }
-        ssleep(1);
-        //mutex_unlock(&elevator.mutex);
-    }
-    return 0;
-}
+// A rider gets off here, or the next waiting passenger fits in the car
+static bool car_has_transfer(void){
+    Passenger *p;
 
+    if(riders_to[elevator.current_floor] > 0)
+        return true;
+    if(turn_off || (p = next_waiting(elevator.current_floor)) == NULL)
+        return false;
+    return num_passengers < MAX_PASSENGERS && elevator.current_load + p->weight <= MAX_LOAD;
+}
 
+// End of a door dwell: one rider gets off, or else the next waiting passenger boards
+void service_floor(void){
+	struct list_head *temp;
+	struct list_head *dummy;
+	Passenger *p;
 
-void moveElevator(void){
-    //mutex_lock(&elevator.mutex);
-    printk(KERN_INFO "moving elevator");
-    if((elevator.current_floor == elevator.current_destination) && (stayOrMove(elevator.current_floor) == 0)){
-        if(num_waiting > 0){
-            printk(KERN_INFO "looking for new destination");
-            getNewDestination();
+    list_for_each_safe(temp, dummy, &elevator.passengers_on_board){
+        p = list_entry(temp, Passenger, list);
+        if(p->destination == elevator.current_floor){
+            num_passengers--;
+            num_serviced++;
+            elevator_notify(ELEVATOR_EVENT_DELIVER, elevator.current_floor, p, 0);
+            elevator.current_load -= p->weight;
+            p->submitter->outstanding--;
+            plan_remove_rider(p);
+            snapshot_stale = true;
+            if(p->has_eta)
+                eta_record_error(&eta_ride_error, ktime_get_ns() - p->boarded_ns, p->eta_ride_ms);
+
+            list_del(temp);
+            kfree(p);
+            return;
         }
-        else{
-            elevator.state = IDLE;
+    }
+
+    // The queue may have changed while the doors were open
+    if(!car_has_transfer())
+        return;
+    p = next_waiting(elevator.current_floor);
+
+    num_waiting--;
+    if(--floors[elevator.current_floor].num_waiting_floor == 0)
+        waiting_stops &= ~(1U << elevator.current_floor);
+    notify_queue_depth(elevator.current_floor, floors[elevator.current_floor].num_waiting_floor + 1);
+    num_passengers++;
+    elevator.current_load += p->weight;
+    record_wait(p);
+    drr_charge(elevator.current_floor, p);
+    p->boarded_ns = ktime_get_ns();
+    if(p->has_eta)
+        eta_record_error(&eta_wait_error, p->boarded_ns - p->enqueued_ns, p->eta_wait_ms);
+    elevator_notify(ELEVATOR_EVENT_BOARD, elevator.current_floor, p, floors[elevator.current_floor].num_waiting_floor);
+
+    // Move passenger from the floor list to the elevator list
+    list_move_tail(&p->list, &elevator.passengers_on_board);
+    list_del(&p->sub_list);
+    plan_add_rider(p);
+    snapshot_stale = true;
+
+    // A slot freed up on this floor
+    wake_up_interruptible(&admission_wq);
+}
+
+static unsigned int car_depart(void){
+    plan_direction = elevator.current_destination > elevator.current_floor ? DIR_UP : DIR_DOWN;
+    snapshot_stale = true;
+    set_state(elevator.current_destination > elevator.current_floor ? UP : DOWN);
+    elevator.phase = CAR_MOVING;
+    return CAR_FLOOR_MS;
+}
+
+// Advance the car by one phase. Returns the ms until the next step, 0 to step again now.
+static unsigned int car_step(void){
+    switch(elevator.phase){
+        case CAR_MOVING:
+            elevator.current_floor += elevator.state == UP ? 1 : -1;
+            snapshot_stale = true;
+            elevator_notify(ELEVATOR_EVENT_ARRIVAL, elevator.current_floor, NULL, 0);
+            elevator.phase = CAR_ARRIVED;
+            return 0;
+
+        case CAR_DOOR_DWELL:
+            service_floor();
+            elevator.phase = CAR_ARRIVED;
+            return 0;
+
+        case CAR_IDLE:
+        case CAR_ARRIVED:
+            break;
+    }
+
+    if(car_has_transfer()){
+        set_state(LOADING);
+        elevator.phase = CAR_DOOR_DWELL;
+        return CAR_DWELL_MS;
+    }
+
+    // Riders to deliver, or passengers to fetch unless shutting down
+    if(num_passengers > 0 || (num_waiting > 0 && !turn_off)){
+        int dest = plan_head();
+
+        if(dest >= 0){
+            elevator.current_destination = dest;
+            return car_depart();
         }
     }
-    else if(elevator.current_floor < elevator.current_destination){
-        elevator.state = UP;
-        ssleep(2);
-        elevator.current_floor += 1;
+
+    if(turn_off){
+        set_state(OFFLINE);
+        elevator.phase = CAR_IDLE;
+        printk(KERN_INFO "Going offline");
+        return 0;
     }
-    else if(elevator.current_floor > elevator.current_destination){
-        elevator.state = DOWN;
-        ssleep(2);
-        elevator.current_floor -= 1;
+
+    if(idle_parking && best_park_floor() != elevator.current_floor){
+        int park = best_park_floor();
+
+        // Each floor passed on the way comes back through here; count the park once
+        if(elevator.current_destination != park || elevator.current_floor == elevator.current_destination)
+            num_park_moves++;
+        elevator.current_destination = park;
+        return car_depart();
     }
-    printk(KERN_INFO "exiting move elevator");
-    //mutex_unlock(&elevator.mutex);
+
+    set_state(IDLE);
+    elevator.phase = CAR_IDLE;
+    return CAR_IDLE_MS;
 }
 
-void getNewDestination(void){
-    
-    // Loop through floors starting at the current floor and going up
-    //mutex_lock(&elevator.mutex);
-    for(int i=0; i< NUM_FLOORS; i++){
-        // If the floor has passengers waiting make it new destination floor
-        if(!list_empty(&floors[(i+elevator.current_floor) % NUM_FLOORS].passengers_waiting)){
-            elevator.current_destination = (i+elevator.current_floor) % NUM_FLOORS;
-            //mutex_unlock(&elevator.mutex);
-            printk(KERN_INFO "destination found");
-            return;
-        }
+// Drives the car: runs steps until one has to wait, then re-arms itself for that long
+static void elevator_work(struct work_struct *work){
+    unsigned int delay;
+    int depth;
+    u64 start, ns;
+
+    elevator_lock(LOCK_CAR);
+    // Frozen for a checkpoint: stay where the checkpoint says the car is
+    if(frozen){
+        elevator_unlock();
+        return;
     }
-    //mutex_unlock(&elevator.mutex);
+    start = ktime_get_ns();
+    depth = min_t(int, fls(num_waiting), STEP_DEPTHS - 1);
+    update_demand();
+    do{
+        delay = car_step();
+    }while(delay == 0 && elevator.state != OFFLINE);
+    if(snapshot_stale)
+        publish_snapshot();
+
+    ns = ktime_get_ns() - start;
+    step_count[depth]++;
+    step_ns[depth] += ns;
+    step_max_ns[depth] = max(step_max_ns[depth], ns);
+
+    // mod_, not queue_: a kick that raced with this run must not cut the new phase short
+    if(elevator.state != OFFLINE)
+        mod_delayed_work(system_wq, &elevator.work, msecs_to_jiffies(delay));
+    elevator_unlock();
 }
 
-void service_floor(void){
-    //mutex_lock(&elevator.mutex);
-    printk(KERN_INFO "service floor");
 
-	struct list_head *temp;
-	struct list_head *dummy;
-	Passenger *p;
+/*
+ * ETA queries replay the car_step() and stop plan policy on a copy of the published
+ * snapshot with the would-be passenger added, so they never take
+ * elevator.mutex and never enqueue anything. A floor is taken to board in
+ * class order, oldest first; aging and the fair queuing rounds are not modelled.
+ */
+struct eta_passenger {
+    u8 destination, weight;
+    bool probe;
+};
 
-    // Check if any passenger on board is at destination
-    if(!list_empty(&elevator.passengers_on_board)){
-        printk(KERN_INFO "inside first service if");
-        list_for_each_safe(temp, dummy, &elevator.passengers_on_board){
-            p = list_entry(temp, Passenger, list);
-	
-            if((p->destination == elevator.current_floor)&& (p!=NULL)){
-                elevator.state = LOADING;
-                printk(KERN_INFO "Loading status");
+struct eta_sim {
+    int floor, destination, direction;
+    int num_riders, load;
+    // Riders in boarding order, then each floor's queue in boarding order
+    struct eta_passenger *riders;
+    struct eta_passenger *queue;
+    int head[NUM_FLOORS], end[NUM_FLOORS];
+};
 
-                ssleep(1);
+// Same choice as plan_head(), from the simulated riders and queues
+static void eta_pick_destination(struct eta_sim *sim){
+    unsigned int stops = 0, above, below;
 
-                num_passengers--;
-                num_serviced++;
-                elevator.current_load -= p->weight;
+    for(int i = 0; i < sim->num_riders; i++)
+        stops |= 1U << sim->riders[i].destination;
+    for(int f = 0; f < NUM_FLOORS && sim->num_riders < MAX_PASSENGERS; f++){
+        if(sim->head[f] < sim->end[f])
+            stops |= 1U << f;
+    }
+    stops &= ~(1U << sim->floor);
+    above = stops & ~((2U << sim->floor) - 1);
+    below = stops & ((1U << sim->floor) - 1);
+
+    if(sim->direction == DIR_UP)
+        sim->destination = above ? __ffs(above) : __fls(below);
+    else
+        sim->destination = below ? __fls(below) : __ffs(above);
+    sim->direction = sim->destination > sim->floor ? DIR_UP : DIR_DOWN;
+}
 
-                list_del(temp);
-                kfree(p);
-            }
-        }
+static int eta_simulate(const struct elevator_snapshot *snap, int start, int dest, int type, int priority,
+                        u32 *wait_ms, u32 *ride_ms){
+    int n = snap->floor_start[NUM_FLOORS];
+    struct eta_sim sim = {};
+    s64 t = 0, boarded = -1;
+    int q = 0, ret = -ERANGE;
+
+    sim.riders = kmalloc_array(snap->num_passengers + MAX_PASSENGERS + 1, sizeof(*sim.riders), GFP_KERNEL);
+    sim.queue = kmalloc_array(n + 1, sizeof(*sim.queue), GFP_KERNEL);
+    if(!sim.riders || !sim.queue){
+        ret = -ENOMEM;
+        goto out;
     }
 
-    // Check if there are any passengers waiting to board at current floor
-    if(!turn_off && !list_empty(&floors[elevator.current_floor].passengers_waiting)){
-        printk(KERN_INFO "checking if passengers waiting");
-        list_for_each_safe(temp, dummy, &floors[elevator.current_floor].passengers_waiting){
-            p = list_entry(temp, Passenger, list);
+    for(int i = 0; i < snap->floor_start[0]; i++){
+        const struct snapshot_passenger *sp = &snap->passengers[i];
 
-            if((num_passengers < 5 ) && (elevator.current_load + p->weight <= MAX_LOAD) && (p!=NULL)){
-                elevator.state = LOADING;
-                ssleep(1);
+        sim.riders[sim.num_riders++] = (struct eta_passenger){sp->destination, type_weights[sp->type], false};
+        sim.load += type_weights[sp->type];
+    }
+    // The probe queues behind everyone of its own class or higher on its floor
+    for(int f = 0; f < NUM_FLOORS; f++){
+        bool probe = f == start;
 
-                num_waiting--;
-                num_passengers++;
-                elevator.current_load += p->weight;
-                
-                // Add passenger to elevator list
-                printk(KERN_INFO "add passenger to elevator");
-                list_add_tail(&p->list, &elevator.passengers_on_board);
+        sim.head[f] = q;
+        for(int i = snap->floor_start[f]; i < snap->floor_start[f + 1]; i++){
+            const struct snapshot_passenger *sp = &snap->passengers[i];
 
-                // Remove passenger from floor list
-                list_del(temp);	
-                kfree(p);
-                printk(KERN_INFO "exiting service floor");
+            if(probe && sp->priority < priority){
+                sim.queue[q++] = (struct eta_passenger){dest, type_weights[type], true};
+                probe = false;
             }
-            else{
-                getNewDestination();
+            sim.queue[q++] = (struct eta_passenger){sp->destination, type_weights[sp->type], false};
+        }
+        if(probe)
+            sim.queue[q++] = (struct eta_passenger){dest, type_weights[type], true};
+        sim.end[f] = q;
+    }
+
+    sim.floor = clamp(snap->current_floor, 0, NUM_FLOORS - 1);
+    sim.destination = clamp(snap->current_destination, 0, NUM_FLOORS - 1);
+    sim.direction = snap->direction;
+
+    // A phase in progress is on average half done
+    if(snap->state == UP || snap->state == DOWN){
+        t = CAR_FLOOR_MS / 2;
+        sim.floor = clamp(sim.floor + (snap->state == UP ? 1 : -1), 0, NUM_FLOORS - 1);
+    }
+    else if(snap->state == LOADING){
+        t = -CAR_DWELL_MS / 2;
+    }
+
+    for(int step = 0; step < ETA_MAX_STEPS; step++){
+        struct eta_passenger *next;
+        int i;
+
+        // A rider gets off
+        for(i = 0; i < sim.num_riders && sim.riders[i].destination != sim.floor; i++)
+            ;
+        if(i < sim.num_riders){
+            t += CAR_DWELL_MS;
+            if(sim.riders[i].probe){
+                *wait_ms = max_t(s64, boarded, 0);
+                *ride_ms = t - max_t(s64, boarded, 0);
+                ret = 0;
+                goto out;
             }
+            sim.load -= sim.riders[i].weight;
+            memmove(&sim.riders[i], &sim.riders[i + 1], (--sim.num_riders - i) * sizeof(sim.riders[0]));
+            continue;
+        }
+
+        // The head of the floor's queue gets on if it fits
+        next = sim.head[sim.floor] < sim.end[sim.floor] ? &sim.queue[sim.head[sim.floor]] : NULL;
+        if(next && sim.num_riders < MAX_PASSENGERS && sim.load + next->weight <= MAX_LOAD){
+            t += CAR_DWELL_MS;
+            if(next->probe)
+                boarded = t;
+            sim.riders[sim.num_riders++] = *next;
+            sim.load += next->weight;
+            sim.head[sim.floor]++;
+            continue;
         }
+
+        // The probe is still waiting or riding, so there is always somewhere to go
+        eta_pick_destination(&sim);
+        sim.floor += sim.destination > sim.floor ? 1 : -1;
+        t += CAR_FLOOR_MS;
     }
-    //mutex_unlock(&elevator.mutex);
+
+out:
+    kfree(sim.riders);
+    kfree(sim.queue);
+    return ret;
 }
 
+// Remember a prediction for eta_claim()
+static void eta_remember(int start, int dest, int type, int priority, u32 wait_ms, u32 ride_ms){
+    struct eta_record *rec;
+
+    spin_lock(&eta_lock);
+    rec = &eta_records[eta_next++ % ETA_RECORDS];
+    rec->tgid = task_tgid_nr(current);
+    rec->start = start;
+    rec->destination = dest;
+    rec->type = type;
+    rec->priority = priority;
+    rec->wait_ms = wait_ms;
+    rec->ride_ms = ride_ms;
+    rec->at_ns = ktime_get_ns();
+    spin_unlock(&eta_lock);
+}
 
-static ssize_t elevator_read(struct file *file, char __user *ubuf, size_t count, loff_t *ppos){
-    char buf[10000];
-    int len = 0;
-    const char *state="";
-    switch(elevator.state){
+// Predicted wait and ride for a request, without making it. Used by the syscall and ELEVATOR_IOC_ETA.
+int elevator_eta(struct elevator_eta __user *ueta){
+    struct elevator_snapshot *snap;
+    struct elevator_eta eta;
+    int type, priority_arg, priority;
+    int ret;
+
+    if(copy_from_user(&eta, ueta, sizeof(eta)))
+        return -EFAULT;
+
+    priority_arg = eta.type >> PRIORITY_SHIFT;
+    type = eta.type & ((1 << PRIORITY_SHIFT) - 1);
+    if(priority_arg > NUM_PRIORITIES || type > VISITOR)
+        return -EINVAL;
+    if(eta.start < 1 || eta.start > NUM_FLOORS || eta.dest < 1 || eta.dest > NUM_FLOORS)
+        return -EINVAL;
+    priority = priority_arg ? priority_arg - 1 : type_priorities[type];
+
+    atomic_long_inc(&eta_queries);
+    snap = snapshot_get();
+    if(!snap)
+        return -EAGAIN;
+    if(snap->state == OFFLINE || snap->turn_off)
+        ret = -ENODEV;
+    else if(READ_ONCE(frozen))
+        ret = -EAGAIN;
+    else
+        ret = eta_simulate(snap, eta.start - 1, eta.dest - 1, type, priority, &eta.wait_ms, &eta.ride_ms);
+    snapshot_put(snap);
+    if(ret)
+        return ret;
+
+    eta_remember(eta.start - 1, eta.dest - 1, type, priority, eta.wait_ms, eta.ride_ms);
+    return copy_to_user(ueta, &eta, sizeof(eta)) ? -EFAULT : 0;
+}
+
+
+static const char *state_name(enum Elevator_state state){
+    switch(state){
         case OFFLINE:
-            state = "OFFLINE";
-            break;
+            return "OFFLINE";
         case IDLE:
-            state = "IDLE";
-            break;
+            return "IDLE";
         case LOADING:
-            state = "LOADING";
-            break;
+            return "LOADING";
         case UP:
-            state = "UP";
-            break;
+            return "UP";
         case DOWN:
-            state = "DOWN";
-            break;
+            return "DOWN";
         default:
-            state = "unknown";
+            return "unknown";
+    }
+}
+
+// Worst-case size of the /proc/elevator text for a snapshot
+static size_t render_size(const struct elevator_snapshot *snap){
+    return 256 + NUM_FLOORS * 32 + snap->floor_start[NUM_FLOORS] * 2;
+}
+
+static int render_labels(const struct elevator_snapshot *snap, int from, int to, char *buf, size_t size){
+    int len = 0;
+
+    for(int i = from; i < to; i++)
+        len += scnprintf(buf + len, size - len, "%c%d",
+                         type_initials[snap->passengers[i].type], snap->passengers[i].destination + 1);
+    return len;
+}
 
+static int render_snapshot(const struct elevator_snapshot *snap, char *buf, size_t size){
+    int len = 0;
+
+    len += scnprintf(buf + len, size - len, "Elevator state:%s", state_name(snap->state));
+    len += scnprintf(buf + len, size - len, "\nCurrent floor: %d", snap->current_floor);
+    len += scnprintf(buf + len, size - len, "\nCurrent load: %d", snap->current_load);
+    len += scnprintf(buf + len, size - len, "\nElevator status: ");
+    len += render_labels(snap, 0, snap->floor_start[0], buf + len, size - len);
+
+    for(int i=0; i<NUM_FLOORS; i++){
+        len += scnprintf(buf + len, size - len, "\n[%c] Floor %d: ",
+                         i == snap->current_floor-1 ? '*' : ' ', i+1);
+        len += render_labels(snap, snap->floor_start[i], snap->floor_start[i+1], buf + len, size - len);
     }
-    
 
-    len = sprintf(buf, "Elevator state:");
-    len += sprintf(buf + len, state);
-    len += sprintf(buf + len, "\nCurrent floor: ");
-    len += sprintf(buf + len, "%d", elevator.current_floor);
-    len += sprintf(buf + len, "\nCurrent load: ");
-    len += sprintf(buf + len, "%d", elevator.current_load);
-    len += sprintf(buf + len, "\nElevator status: ");
-
-    if(!list_empty(&elevator.passengers_on_board)){
-        struct list_head *temp;
-        Passenger *passenger;
-
-        list_for_each(temp,&elevator.passengers_on_board){
-            passenger = list_entry(temp, Passenger,list);
-            len += sprintf(buf + len, passenger->str);
+    len += scnprintf(buf + len, size - len, "\nNumber of passengers: %d", snap->num_passengers);
+    len += scnprintf(buf + len, size - len, "\nNumber of passengers waiting: %d", snap->num_waiting);
+    len += scnprintf(buf + len, size - len, "\nNumber of passengers serviced :%d", snap->num_serviced);
+    return len;
+}
+
+static struct rendered_text *render_text(const struct elevator_snapshot *snap){
+    size_t size = render_size(snap);
+    struct rendered_text *r = kvmalloc(sizeof(*r) + size, GFP_KERNEL);
+
+    if(r)
+        r->len = render_snapshot(snap, r->text, size);
+    return r;
+}
+
+/*
+ * Renders from the published snapshot only, never touching the live lists or
+ * the mutex. The text is formatted once per snapshot generation and shared by
+ * every later reader of that generation.
+ */
+static ssize_t elevator_read(struct file *file, char __user *ubuf, size_t count, loff_t *ppos){
+    struct elevator_snapshot *snap = snapshot_get();
+    struct rendered_text *r, *old;
+    ssize_t ret;
+    u64 start;
+
+    if(!snap)
+        return 0;
+
+    r = smp_load_acquire(&snap->rendered);
+    if(r){
+        atomic_long_inc(&render_hits);
+    }
+    else{
+        start = ktime_get_ns();
+        r = render_text(snap);
+        if(!r){
+            snapshot_put(snap);
+            return -ENOMEM;
+        }
+        atomic64_add(ktime_get_ns() - start, &render_ns);
+        atomic_long_inc(&render_misses);
+
+        // Another reader may have rendered the same generation meanwhile
+        old = cmpxchg(&snap->rendered, NULL, r);
+        if(old){
+            kvfree(r);
+            r = old;
         }
     }
 
-    for(int i=0; i<NUM_FLOORS; i++){
-        len += sprintf(buf + len, "\n");
-        len += sprintf(buf + len, "[");
+    ret = simple_read_from_buffer(ubuf, count, ppos, r->text, r->len);
+    snapshot_put(snap);
+    return ret;
+}
 
-         if(i == elevator.current_floor-1)
-            len += sprintf(buf + len, "*]");
-        else
-            len += sprintf(buf + len, " ]");
-        
-        
-        len += sprintf(buf + len, " Floor ");
-        len += sprintf(buf + len, "%d", i+1);
+static const struct proc_ops elevator_fops = {
+    .proc_read = elevator_read,
+};
 
-        len += sprintf(buf + len, ": ");
+/*
+ * Machine-readable views of the same snapshot. Ages are relative to the time of
+ * the read, so unlike the text view these are built on every read.
+ */
+static ssize_t elevator_bin_read(struct file *file, char __user *ubuf, size_t count, loff_t *ppos){
+    struct elevator_snapshot *snap = snapshot_get();
+    struct elevator_bin_header *hdr;
+    struct elevator_bin_passenger *rec;
+    size_t size;
+    ssize_t ret;
+    u64 now;
+
+    if(!snap)
+        return 0;
+
+    size = sizeof(*hdr) + snap->floor_start[NUM_FLOORS] * sizeof(*rec);
+    hdr = kvzalloc(size, GFP_KERNEL);
+    if(!hdr){
+        snapshot_put(snap);
+        return -ENOMEM;
+    }
 
-        if(!list_empty(&floors[i].passengers_waiting)){
-            struct list_head *temp;
-            Passenger *passenger;
+    now = ktime_get_ns();
+    hdr->magic = cpu_to_le32(ELEVATOR_BIN_MAGIC);
+    hdr->version = cpu_to_le32(ELEVATOR_BIN_VERSION);
+    hdr->size = cpu_to_le32(size);
+    hdr->record_size = cpu_to_le32(sizeof(*rec));
+    hdr->generation = cpu_to_le64(snap->generation);
+    hdr->timestamp_ns = cpu_to_le64(now);
+    hdr->state = cpu_to_le32(snap->state);
+    hdr->current_floor = cpu_to_le32(snap->current_floor + 1);
+    hdr->current_load = cpu_to_le32(snap->current_load);
+    hdr->num_passengers = cpu_to_le32(snap->num_passengers);
+    hdr->num_waiting = cpu_to_le32(snap->num_waiting);
+    hdr->num_serviced = cpu_to_le32(snap->num_serviced);
+    hdr->num_admitted = cpu_to_le64(READ_ONCE(num_admitted));
+    hdr->num_rejected = cpu_to_le64(READ_ONCE(num_rejected));
+    hdr->num_blocked = cpu_to_le64(READ_ONCE(num_blocked));
+    hdr->num_floors = cpu_to_le32(NUM_FLOORS);
+    hdr->num_records = cpu_to_le32(snap->floor_start[NUM_FLOORS]);
+    hdr->floor_count[0] = cpu_to_le32(snap->floor_start[0]);
+    for(int i = 0; i < NUM_FLOORS; i++)
+        hdr->floor_count[i + 1] = cpu_to_le32(snap->floor_start[i + 1] - snap->floor_start[i]);
+
+    rec = (struct elevator_bin_passenger *)(hdr + 1);
+    for(int i = 0; i < snap->floor_start[NUM_FLOORS]; i++){
+        rec[i].type = snap->passengers[i].type;
+        rec[i].start = snap->passengers[i].start + 1;
+        rec[i].destination = snap->passengers[i].destination + 1;
+        rec[i].priority = snap->passengers[i].priority;
+        rec[i].age_ns = cpu_to_le64(now - snap->passengers[i].enqueued_ns);
+    }
+    snapshot_put(snap);
 
-            list_for_each(temp,&floors[i].passengers_waiting){
-                passenger = list_entry(temp, Passenger,list);
-                len += sprintf(buf + len, passenger->str);
+    ret = simple_read_from_buffer(ubuf, count, ppos, hdr, size);
+    kvfree(hdr);
+    return ret;
+}
+
+static const struct proc_ops elevator_bin_fops = {
+    .proc_read = elevator_bin_read,
+};
+
+static int render_json_passengers(const struct elevator_snapshot *snap, int from, int to, u64 now, char *buf, size_t size){
+    int len = 0;
+
+    len += scnprintf(buf + len, size - len, "[");
+    for(int i = from; i < to; i++)
+        len += scnprintf(buf + len, size - len, "%s{\"type\":\"%c\",\"dest\":%d,\"prio\":%d,\"age_ms\":%llu}",
+                         i > from ? "," : "", type_initials[snap->passengers[i].type],
+                         snap->passengers[i].destination + 1, snap->passengers[i].priority,
+                         div_u64(now - snap->passengers[i].enqueued_ns, NSEC_PER_MSEC));
+    len += scnprintf(buf + len, size - len, "]");
+    return len;
+}
+
+static ssize_t elevator_json_read(struct file *file, char __user *ubuf, size_t count, loff_t *ppos){
+    struct elevator_snapshot *snap = snapshot_get();
+    size_t size;
+    ssize_t ret;
+    char *buf;
+    int len = 0;
+    u64 now;
+
+    if(!snap)
+        return 0;
+
+    size = 512 + NUM_FLOORS * 48 + snap->floor_start[NUM_FLOORS] * 64;
+    buf = kvmalloc(size, GFP_KERNEL);
+    if(!buf){
+        snapshot_put(snap);
+        return -ENOMEM;
+    }
+
+    now = ktime_get_ns();
+    len += scnprintf(buf + len, size - len,
+                     "{\"version\":1,\"generation\":%llu,\"state\":\"%s\",\"floor\":%d,\"load\":%d,"
+                     "\"passengers\":%d,\"waiting\":%d,\"serviced\":%d,"
+                     "\"admitted\":%lu,\"rejected\":%lu,\"blocked\":%lu,\"on_board\":",
+                     snap->generation, state_name(snap->state), snap->current_floor + 1, snap->current_load,
+                     snap->num_passengers, snap->num_waiting, snap->num_serviced,
+                     READ_ONCE(num_admitted), READ_ONCE(num_rejected), READ_ONCE(num_blocked));
+    len += render_json_passengers(snap, 0, snap->floor_start[0], now, buf + len, size - len);
+    len += scnprintf(buf + len, size - len, ",\"floors\":[");
+    for(int i = 0; i < NUM_FLOORS; i++){
+        len += scnprintf(buf + len, size - len, "%s{\"floor\":%d,\"waiting\":", i ? "," : "", i + 1);
+        len += render_json_passengers(snap, snap->floor_start[i], snap->floor_start[i + 1], now, buf + len, size - len);
+        len += scnprintf(buf + len, size - len, "}");
+    }
+    len += scnprintf(buf + len, size - len, "]}\n");
+    snapshot_put(snap);
+
+    ret = simple_read_from_buffer(ubuf, count, ppos, buf, len);
+    kvfree(buf);
+    return ret;
+}
+
+static const struct proc_ops elevator_json_fops = {
+    .proc_read = elevator_json_read,
+};
+
+/*
+ * /dev/elevator: the same entry points as the syscalls, as ioctls, so the
+ * module also works on a stock kernel. See elevator_uapi.h for the ABI.
+ */
+static long elevator_ioctl_batch(struct elevator_batch __user *ubatch){
+    struct elevator_request reqs[BATCH_CHUNK];
+    struct elevator_request __user *ureqs;
+    struct elevator_batch batch;
+    u32 done = 0;
+    long ret = 0;
+
+    if(copy_from_user(&batch, ubatch, sizeof(batch)))
+        return -EFAULT;
+    ureqs = u64_to_user_ptr(batch.requests);
+
+    while(done < batch.count){
+        u32 n = min_t(u32, batch.count - done, BATCH_CHUNK);
+
+        if(copy_from_user(reqs, ureqs + done, n * sizeof(reqs[0]))){
+            ret = -EFAULT;
+            break;
+        }
+        for(u32 i = 0; i < n; i++){
+            reqs[i].result = issue_request(reqs[i].start, reqs[i].dest, reqs[i].type);
+            // Stop on a signal; restarting would resubmit what was already queued
+            if(reqs[i].result == -ERESTARTSYS){
+                reqs[i].result = -EINTR;
+                n = i + 1;
+                ret = -EINTR;
+                break;
             }
         }
+        if(copy_to_user(ureqs + done, reqs, n * sizeof(reqs[0]))){
+            ret = -EFAULT;
+            break;
+        }
+        done += n;
+        if(ret)
+            break;
     }
 
-    len += sprintf(buf + len, "\nNumber of passengers: ");
-    len += sprintf(buf + len, "%d", num_passengers);
-    len += sprintf(buf + len, "\nNumber of passengers waiting: ");
-    len += sprintf(buf + len, "%d", num_waiting);
-    len += sprintf(buf + len, "\nNumber of passengers serviced :");
-    len += sprintf(buf + len, "%d", num_serviced);
+    if(put_user(done, &ubatch->done))
+        return -EFAULT;
+    return done ? done : ret;
+}
+
+static long elevator_ioctl_stats(struct elevator_stats __user *ustats){
+    struct elevator_snapshot *snap = snapshot_get();
+    struct elevator_stats stats = {};
+
+    if(snap){
+        stats.state = snap->state;
+        stats.current_floor = snap->current_floor + 1;
+        stats.current_load = snap->current_load;
+        stats.num_passengers = snap->num_passengers;
+        stats.num_waiting = snap->num_waiting;
+        stats.num_serviced = snap->num_serviced;
+        stats.generation = snap->generation;
+        snapshot_put(snap);
+    }
+    stats.num_admitted = READ_ONCE(num_admitted);
+    stats.num_rejected = READ_ONCE(num_rejected);
+    stats.num_blocked = READ_ONCE(num_blocked);
 
-    return simple_read_from_buffer(ubuf, count, ppos, buf, len);
+    return copy_to_user(ustats, &stats, sizeof(stats)) ? -EFAULT : 0;
 }
 
-static const struct proc_ops elevator_fops = {
-    .proc_read = elevator_read,
+static long elevator_ioctl(struct file *file, unsigned int cmd, unsigned long arg){
+    void __user *uarg = (void __user *)arg;
+    struct elevator_request req;
+
+    switch(cmd){
+        case ELEVATOR_IOC_START:
+            return start_elevator();
+        case ELEVATOR_IOC_STOP:
+            return stop_elevator();
+        case ELEVATOR_IOC_REQUEST:
+            if(copy_from_user(&req, uarg, sizeof(req)))
+                return -EFAULT;
+            return issue_request(req.start, req.dest, req.type);
+        case ELEVATOR_IOC_BATCH:
+            return elevator_ioctl_batch(uarg);
+        case ELEVATOR_IOC_STATS:
+            return elevator_ioctl_stats(uarg);
+        case ELEVATOR_IOC_ETA:
+            return elevator_eta(uarg);
+        default:
+            return -ENOTTY;
+    }
+}
+
+static const struct file_operations elevator_dev_fops = {
+    .owner = THIS_MODULE,
+    .unlocked_ioctl = elevator_ioctl,
+    .compat_ioctl = compat_ptr_ioctl,
 };
 
-static int __init elevator_init(void){
-    STUB_start_elevator = start_elevator;
-    STUB_issue_request = issue_request;
-    STUB_stop_elevator = stop_elevator;
-    
+static struct miscdevice elevator_dev = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name = ENTRY_NAME,
+    .fops = &elevator_dev_fops,
+    .mode = 0666,
+};
 
-    elevator_entry = proc_create(ENTRY_NAME, PERMS, PARENT, &elevator_fops);
-    if (!elevator_entry) {
+static void (*syscalls_unregister)(void);
+
+static ssize_t elevator_stats_read(struct file *file, char __user *ubuf, size_t count, loff_t *ppos){
+    struct submitter *sub;
+    size_t size = 16384;
+    char *buf;
+    int len = 0;
+    ssize_t ret;
+
+    buf = kmalloc(size, GFP_KERNEL);
+    if(!buf)
         return -ENOMEM;
+
+    elevator_lock(LOCK_STATS);
+    len += scnprintf(buf + len, size - len, "Admitted: %lu\n", num_admitted);
+    len += scnprintf(buf + len, size - len, "Rejected: %lu\n", num_rejected);
+    len += scnprintf(buf + len, size - len, "Blocked: %lu\n", num_blocked);
+    len += scnprintf(buf + len, size - len, "Over quota: %lu (max %d per process)\n",
+                     num_quota_rejected, max_outstanding_per_process);
+    len += scnprintf(buf + len, size - len, "Waiting: %d / %d\n", num_waiting, max_waiting_total);
+    for(int i=0; i<NUM_FLOORS; i++)
+        len += scnprintf(buf + len, size - len, "Floor %d waiting: %d / %d\n",
+                         i+1, floors[i].num_waiting_floor, max_waiting_per_floor);
+    for(int prio = NUM_PRIORITIES - 1; prio >= 0; prio--)
+        len += scnprintf(buf + len, size - len,
+                         "Class %s waits: n=%lu p50<=%llums p90<=%llums p99<=%llums max=%llums\n",
+                         priority_names[prio], wait_count[prio],
+                         hist_percentile(wait_hist[prio], WAIT_BUCKETS, wait_count[prio], 50),
+                         hist_percentile(wait_hist[prio], WAIT_BUCKETS, wait_count[prio], 90),
+                         hist_percentile(wait_hist[prio], WAIT_BUCKETS, wait_count[prio], 99), wait_max_ms[prio]);
+    len += scnprintf(buf + len, size - len, "Idle parking: %s, target floor %d, moves %lu\n",
+                     idle_parking ? "on" : "off", best_park_floor() + 1, num_park_moves);
+    len += scnprintf(buf + len, size - len, "Idle-arrival pickups: n=%lu avg=%llums\n",
+                     idle_pickup_count, idle_pickup_count ? div_u64(idle_pickup_total_ms, idle_pickup_count) : 0);
+    {
+        unsigned long hits = atomic_long_read(&render_hits);
+        unsigned long misses = atomic_long_read(&render_misses);
+        u64 avg_ns = misses ? div64_u64(atomic64_read(&render_ns), misses) : 0;
+
+        len += scnprintf(buf + len, size - len,
+                         "Render cache: generation %llu, hits %lu, misses %lu, hit rate %lu%%, avg render %lluns, saved ~%lluus\n",
+                         state_generation, hits, misses, hits + misses ? hits * 100 / (hits + misses) : 0,
+                         avg_ns, div_u64(hits * avg_ns, NSEC_PER_USEC));
     }
+    for(int i=0; i<NUM_FLOORS; i++)
+        len += scnprintf(buf + len, size - len, "Floor %d demand (arrivals/s): up=%lu.%03lu down=%lu.%03lu\n", i+1,
+                         floor_demand[i][DIR_UP] / DEMAND_SCALE, floor_demand[i][DIR_UP] % DEMAND_SCALE,
+                         floor_demand[i][DIR_DOWN] / DEMAND_SCALE, floor_demand[i][DIR_DOWN] % DEMAND_SCALE);
+    {
+        unsigned int stops = plan_stops();
+        int dir = plan_direction;
+
+        // The plan in the order the car will serve it
+        len += scnprintf(buf + len, size - len, "Stop plan (going %s):", dir == DIR_UP ? "up" : "down");
+        for(int pass = 0; pass < 2; pass++, dir = !dir){
+            for(int i = 1; i < NUM_FLOORS; i++){
+                int f = elevator.current_floor + (dir == DIR_UP ? i : -i);
+
+                if(f >= 0 && f < NUM_FLOORS && (stops & (1U << f)))
+                    len += scnprintf(buf + len, size - len, " %d", f + 1);
+            }
+        }
+        len += scnprintf(buf + len, size - len, "\n");
+    }
+    len += scnprintf(buf + len, size - len, "Car step cost by passengers waiting:");
+    for(int d = 0; d < STEP_DEPTHS; d++){
+        if(step_count[d])
+            len += scnprintf(buf + len, size - len, " <%d: n=%lu avg=%lluns max=%lluns;", 1 << d,
+                             step_count[d], div64_u64(step_ns[d], step_count[d]), step_max_ns[d]);
+    }
+    len += scnprintf(buf + len, size - len, "\n");
+    len += scnprintf(buf + len, size - len, "ETA queries: %lu, matched to requests: %lu\n",
+                     atomic_long_read(&eta_queries), eta_matched);
+    for(int kind = 0; kind < 2; kind++){
+        struct eta_error *err = kind ? &eta_ride_error : &eta_wait_error;
+
+        len += scnprintf(buf + len, size - len,
+                         "ETA %s error: n=%lu p50<=%llums p90<=%llums p99<=%llums max=%llums bias=%lldms\n",
+                         kind ? "ride" : "wait", err->count,
+                         hist_percentile(err->hist, WAIT_BUCKETS, err->count, 50),
+                         hist_percentile(err->hist, WAIT_BUCKETS, err->count, 90),
+                         hist_percentile(err->hist, WAIT_BUCKETS, err->count, 99), err->max_ms,
+                         err->count ? div_s64(err->bias_ms, err->count) : 0);
+    }
+    len += scnprintf(buf + len, size - len, "Fair queuing: %s\n", fair_queuing ? "on" : "off");
+    list_for_each_entry(sub, &submitters, list)
+        len += scnprintf(buf + len, size - len,
+                         "Submitter %d (%s): outstanding %d, waits n=%lu p50<=%llums p90<=%llums p99<=%llums max=%llums\n",
+                         sub->tgid, sub->comm, sub->outstanding, sub->wait_count,
+                         hist_percentile(sub->wait_hist, WAIT_BUCKETS, sub->wait_count, 50),
+                         hist_percentile(sub->wait_hist, WAIT_BUCKETS, sub->wait_count, 90),
+                         hist_percentile(sub->wait_hist, WAIT_BUCKETS, sub->wait_count, 99), sub->wait_max_ms);
+    elevator_unlock();
+
+    ret = simple_read_from_buffer(ubuf, count, ppos, buf, len);
+    kfree(buf);
+    return ret;
+}
 
-    elevator.state = OFFLINE;
-    INIT_LIST_HEAD(&elevator.passengers_on_board);
+static const struct proc_ops elevator_stats_fops = {
+    .proc_read = elevator_stats_read,
+};
 
-    mutex_init(&elevator.mutex);
+static ssize_t lock_stats_read(struct file *file, char __user *ubuf, size_t count, loff_t *ppos){
+    struct lock_site_stats *stats;
+    char *buf;
+    // Header and one summary line per site, then a wait and a hold histogram line per site
+    size_t size = (NUM_LOCK_SITES + 1) * LOCK_LINE_MAX +
+                  NUM_LOCK_SITES * 2 * (LOCK_LINE_MAX + LOCK_BUCKETS * LOCK_ENTRY_MAX);
+    int len = 0;
+    ssize_t ret;
 
-    // Needs to be modified
-    elevator.kthread = kthread_run(elevator_run, &elevator, "elevator thread");
+    buf = kmalloc(size, GFP_KERNEL);
+    stats = kmalloc(sizeof(lock_site_stats), GFP_KERNEL);
+    if(!buf || !stats){
+        kfree(buf);
+        kfree(stats);
+        return -ENOMEM;
+    }
 
-    for(int i=0; i<NUM_FLOORS; i++){
-        floors[i].num_waiting_floor = 0;
-        INIT_LIST_HEAD(&floors[i].passengers_waiting);
+    // Copy under the raw mutex so reading the stats does not show up in them
+    mutex_lock(&elevator.mutex);
+    memcpy(stats, lock_site_stats, sizeof(lock_site_stats));
+    mutex_unlock(&elevator.mutex);
+
+    len += scnprintf(buf + len, size - len, "%-10s %10s %10s %10s %10s %10s %10s %10s %10s\n",
+                     "site", "acquired", "contended", "wait_avg", "wait_p99", "wait_max",
+                     "hold_avg", "hold_p99", "hold_max");
+    for(int i = 0; i < NUM_LOCK_SITES; i++){
+        struct lock_site_stats *ls = &stats[i];
+
+        len += scnprintf(buf + len, size - len, "%-10s %10lu %10lu %8lluus %8lluus %8lluus %8lluus %8lluus %8lluus\n",
+                         lock_site_names[i], ls->acquired, ls->contended,
+                         ls->contended ? div_u64(ls->wait_ns, ls->contended * NSEC_PER_USEC) : 0,
+                         hist_percentile(ls->wait_hist, LOCK_BUCKETS, ls->contended, 99), div_u64(ls->wait_max_ns, NSEC_PER_USEC),
+                         ls->acquired ? div_u64(ls->hold_ns, ls->acquired * NSEC_PER_USEC) : 0,
+                         hist_percentile(ls->hold_hist, LOCK_BUCKETS, ls->acquired, 99), div_u64(ls->hold_max_ns, NSEC_PER_USEC));
     }
 
+    // Full histograms: count per "<N us" bucket, empty buckets left out
+    for(int i = 0; i < NUM_LOCK_SITES; i++){
+        for(int kind = 0; kind < 2; kind++){
+            const unsigned long *hist = kind ? stats[i].hold_hist : stats[i].wait_hist;
 
+            len += scnprintf(buf + len, size - len, "%s %s:", lock_site_names[i], kind ? "hold" : "wait");
+            for(int b = 0; b < LOCK_BUCKETS; b++){
+                if(hist[b])
+                    len += scnprintf(buf + len, size - len, " <%lu:%lu", 1UL << b, hist[b]);
+            }
+            len += scnprintf(buf + len, size - len, "\n");
+        }
+    }
+
+    ret = simple_read_from_buffer(ubuf, count, ppos, buf, len);
+    kfree(stats);
+    kfree(buf);
+    return ret;
+}
+
+static const struct file_operations lock_stats_fops = {
+    .owner = THIS_MODULE,
+    .read = lock_stats_read,
+};
+
+// Any write clears the lock stats
+static ssize_t lock_stats_reset_write(struct file *file, const char __user *ubuf, size_t count, loff_t *ppos){
+    mutex_lock(&elevator.mutex);
+    memset(lock_site_stats, 0, sizeof(lock_site_stats));
+    mutex_unlock(&elevator.mutex);
+    return count;
+}
+
+static const struct file_operations lock_stats_reset_fops = {
+    .owner = THIS_MODULE,
+    .write = lock_stats_reset_write,
+};
+
+/*
+ * Checkpoint and restore. Reading /proc/elevator_checkpoint returns a versioned,
+ * little-endian snapshot of the car, the floor queues, the counters and the stats.
+ * Writing that snapshot back after the next insmod restores it, so a module upgrade
+ * does not lose waiting or riding passengers.
+ *
+ * Opening the file for reading freezes the module first: the car stops where it
+ * is, and start, stop and new requests fail with -EAGAIN until it is unloaded.
+ * Nothing can then board or be delivered between the export and rmmod, which
+ * would otherwise be lost or delivered twice after the restore.
+ */
+struct checkpoint_header {
+    __le32 magic;
+    __le32 version;
+    __le32 size;
+    __le32 num_floors;
+    __le32 num_priorities;
+    __le32 wait_buckets;
+    __le32 state;
+    __le32 current_floor;
+    __le32 current_destination;
+    // Not used by the restore, which adds up the riders' weights
+    __le32 current_load;
+    __le32 turn_off;
+    __le32 num_serviced;
+    __le32 num_records;
+    __le32 reserved;
+    __le64 num_admitted;
+    __le64 num_rejected;
+    __le64 num_blocked;
+    __le64 num_park_moves;
+    __le64 idle_pickup_count;
+    __le64 idle_pickup_total_ms;
+    __le64 wait_count[NUM_PRIORITIES];
+    __le64 wait_max_ms[NUM_PRIORITIES];
+    __le64 wait_hist[NUM_PRIORITIES][WAIT_BUCKETS];
+    __le64 floor_demand[NUM_FLOORS][2];
+} __packed;
+
+// One per passenger, riders first, then each floor from the highest class down
+struct checkpoint_passenger {
+    __le32 start;
+    __le32 destination;
+    __le32 weight;
+    __le32 priority;
+    __le32 flags;
+    u8 initial;
+    u8 reserved[3];
+    __le64 waited_ns;
+} __packed;
+
+struct checkpoint_file {
+    void *data;
+    size_t len, cap;
+    bool restored;
+};
+
+// Header, records, then a crc32 of everything before it
+static size_t checkpoint_size(u32 num_records){
+    return sizeof(struct checkpoint_header) + num_records * sizeof(struct checkpoint_passenger) + sizeof(__le32);
+}
+
+// Called with elevator.mutex held
+static void free_all_passengers(void){
+    struct submitter *sub;
+    Passenger *p, *tmp;
+
+    list_for_each_entry_safe(p, tmp, &elevator.passengers_on_board, list){
+        list_del(&p->list);
+        kfree(p);
+    }
+    for(int i = 0; i < NUM_FLOORS; i++){
+        for(int prio = 0; prio < NUM_PRIORITIES; prio++){
+            list_for_each_entry_safe(p, tmp, &floors[i].passengers_waiting[prio], list){
+                list_del(&p->list);
+                kfree(p);
+            }
+        }
+        floors[i].num_waiting_floor = 0;
+        INIT_LIST_HEAD(&floors[i].rr);
+    }
     num_passengers = 0;
-    num_serviced = 0;
     num_waiting = 0;
+    elevator.current_load = 0;
+    memset(riders_to, 0, sizeof(riders_to));
+    rider_stops = 0;
+    waiting_stops = 0;
+
+    // Submitters keep their wait stats, but nothing is queued for them any more
+    list_for_each_entry(sub, &submitters, list){
+        sub->outstanding = 0;
+        for(int i = 0; i < NUM_FLOORS; i++){
+            sub->waiting[i] = 0;
+            sub->deficit[i] = 0;
+            sub->turn[i] = false;
+            INIT_LIST_HEAD(&sub->rr[i]);
+            for(int prio = 0; prio < NUM_PRIORITIES; prio++)
+                INIT_LIST_HEAD(&sub->queue[i][prio]);
+        }
+    }
+}
+
+// Passengers and submitters, on unload or a failed load. Called with elevator.mutex held.
+static void free_all_state(void){
+    struct submitter *sub, *tmp;
+
+    free_all_passengers();
+    list_for_each_entry_safe(sub, tmp, &submitters, list){
+        list_del(&sub->list);
+        kfree(sub);
+    }
+    num_submitters = 0;
+}
+
+static void checkpoint_put_passenger(struct checkpoint_passenger *rec, Passenger *p, u32 flags, u64 now){
+    if(p->idle_arrival)
+        flags |= CHECKPOINT_IDLE_ARRIVAL;
+    rec->start = cpu_to_le32(p->start);
+    rec->destination = cpu_to_le32(p->destination);
+    rec->weight = cpu_to_le32(p->weight);
+    rec->priority = cpu_to_le32(p->priority);
+    rec->flags = cpu_to_le32(flags);
+    rec->initial = p->str[0];
+    rec->waited_ns = cpu_to_le64(now - p->enqueued_ns);
+}
+
+static void *checkpoint_build(size_t *size){
+    struct checkpoint_header *hdr;
+    struct checkpoint_passenger *rec;
+    Passenger *p;
+    u32 n = 0;
+    size_t len;
+    u64 now;
+
+    // Freeze, then wait out a car step already running; frozen steps never re-arm
+    elevator_lock(LOCK_CHECKPOINT);
+    if(!frozen)
+        printk(KERN_INFO "elevator: frozen for checkpoint, reload the module to continue");
+    frozen = true;
+    elevator_unlock();
+    wake_up_interruptible_all(&admission_wq);
+    cancel_delayed_work_sync(&elevator.work);
+
+    elevator_lock(LOCK_CHECKPOINT);
+    list_for_each_entry(p, &elevator.passengers_on_board, list)
+        n++;
+    for(int i = 0; i < NUM_FLOORS; i++)
+        for(int prio = 0; prio < NUM_PRIORITIES; prio++)
+            list_for_each_entry(p, &floors[i].passengers_waiting[prio], list)
+                n++;
+
+    len = checkpoint_size(n);
+    hdr = kvzalloc(len, GFP_KERNEL);
+    if(!hdr){
+        elevator_unlock();
+        return NULL;
+    }
+
+    hdr->magic = cpu_to_le32(CHECKPOINT_MAGIC);
+    hdr->version = cpu_to_le32(CHECKPOINT_VERSION);
+    hdr->size = cpu_to_le32(len);
+    hdr->num_floors = cpu_to_le32(NUM_FLOORS);
+    hdr->num_priorities = cpu_to_le32(NUM_PRIORITIES);
+    hdr->wait_buckets = cpu_to_le32(WAIT_BUCKETS);
+    hdr->state = cpu_to_le32(elevator.state);
+    hdr->current_floor = cpu_to_le32(elevator.current_floor);
+    hdr->current_destination = cpu_to_le32(elevator.current_destination);
+    hdr->current_load = cpu_to_le32(elevator.current_load);
+    hdr->turn_off = cpu_to_le32(turn_off);
+    hdr->num_serviced = cpu_to_le32(num_serviced);
+    hdr->num_records = cpu_to_le32(n);
+    hdr->num_admitted = cpu_to_le64(num_admitted);
+    hdr->num_rejected = cpu_to_le64(num_rejected);
+    hdr->num_blocked = cpu_to_le64(num_blocked);
+    hdr->num_park_moves = cpu_to_le64(num_park_moves);
+    hdr->idle_pickup_count = cpu_to_le64(idle_pickup_count);
+    hdr->idle_pickup_total_ms = cpu_to_le64(idle_pickup_total_ms);
+    for(int prio = 0; prio < NUM_PRIORITIES; prio++){
+        hdr->wait_count[prio] = cpu_to_le64(wait_count[prio]);
+        hdr->wait_max_ms[prio] = cpu_to_le64(wait_max_ms[prio]);
+        for(int b = 0; b < WAIT_BUCKETS; b++)
+            hdr->wait_hist[prio][b] = cpu_to_le64(wait_hist[prio][b]);
+    }
+    for(int i = 0; i < NUM_FLOORS; i++){
+        hdr->floor_demand[i][DIR_UP] = cpu_to_le64(floor_demand[i][DIR_UP]);
+        hdr->floor_demand[i][DIR_DOWN] = cpu_to_le64(floor_demand[i][DIR_DOWN]);
+    }
+
+    rec = (struct checkpoint_passenger *)(hdr + 1);
+    now = ktime_get_ns();
+    list_for_each_entry(p, &elevator.passengers_on_board, list)
+        checkpoint_put_passenger(rec++, p, CHECKPOINT_ON_BOARD, now);
+    for(int i = 0; i < NUM_FLOORS; i++)
+        for(int prio = NUM_PRIORITIES - 1; prio >= 0; prio--)
+            list_for_each_entry(p, &floors[i].passengers_waiting[prio], list)
+                checkpoint_put_passenger(rec++, p, 0, now);
+    elevator_unlock();
+
+    *(__le32 *)rec = cpu_to_le32(crc32_le(~0, (u8 *)hdr, len - sizeof(__le32)));
+    *size = len;
+    return hdr;
+}
+
+static int type_from_initial(char initial){
+    const char *c = initial ? strchr(type_initials, initial) : NULL;
+
+    return c ? c - type_initials : PART_TIME;
+}
+
+static int checkpoint_restore(const void *buf, size_t len){
+    const struct checkpoint_header *hdr = buf;
+    const struct checkpoint_passenger *rec = (const void *)(hdr + 1);
+    struct submitter *restored;
+    int riders = 0, load = 0;
+    u32 n;
+    u64 now;
+
+    if(len < checkpoint_size(0))
+        return -EINVAL;
+    n = le32_to_cpu(hdr->num_records);
+    if(le32_to_cpu(hdr->magic) != CHECKPOINT_MAGIC || le32_to_cpu(hdr->version) != CHECKPOINT_VERSION)
+        return -EINVAL;
+    if(le32_to_cpu(hdr->num_floors) != NUM_FLOORS || le32_to_cpu(hdr->num_priorities) != NUM_PRIORITIES ||
+       le32_to_cpu(hdr->wait_buckets) != WAIT_BUCKETS)
+        return -EINVAL;
+    if(n > (len - sizeof(*hdr)) / sizeof(*rec) || len != checkpoint_size(n))
+        return -EINVAL;
+    if(le32_to_cpu(*(const __le32 *)(rec + n)) != crc32_le(~0, buf, len - sizeof(__le32)))
+        return -EBADMSG;
+    if(le32_to_cpu(hdr->state) > DOWN || le32_to_cpu(hdr->current_floor) >= NUM_FLOORS ||
+       le32_to_cpu(hdr->current_destination) >= NUM_FLOORS)
+        return -EINVAL;
+    for(u32 i = 0; i < n; i++){
+        if(le32_to_cpu(rec[i].start) >= NUM_FLOORS || le32_to_cpu(rec[i].destination) >= NUM_FLOORS ||
+           le32_to_cpu(rec[i].priority) >= NUM_PRIORITIES)
+            return -EINVAL;
+        // Weights and the load follow from the riders, whatever the file says
+        if(le32_to_cpu(rec[i].flags) & CHECKPOINT_ON_BOARD){
+            riders++;
+            load += type_weights[type_from_initial(rec[i].initial)];
+        }
+    }
+    if(riders > MAX_PASSENGERS || load > MAX_LOAD)
+        return -EINVAL;
+
+    elevator_lock(LOCK_CHECKPOINT);
+    if(frozen || elevator.state != OFFLINE || num_waiting > 0 || num_passengers > 0){
+        elevator_unlock();
+        return -EBUSY;
+    }
+
+    // The submitting processes are not in the checkpoint, restored passengers share one
+    restored = submitter_get(0);
+    if(!restored){
+        elevator_unlock();
+        return -ENOMEM;
+    }
 
+    now = ktime_get_ns();
+    for(u32 i = 0; i < n; i++){
+        Passenger *p = kmalloc(sizeof(Passenger), GFP_KERNEL_ACCOUNT);
+        u32 flags = le32_to_cpu(rec[i].flags);
+
+        if(!p){
+            free_all_passengers();
+            elevator_unlock();
+            return -ENOMEM;
+        }
+        p->start = le32_to_cpu(rec[i].start);
+        p->destination = le32_to_cpu(rec[i].destination);
+        p->type = type_from_initial(rec[i].initial);
+        p->weight = type_weights[p->type];
+        p->priority = le32_to_cpu(rec[i].priority);
+        p->idle_arrival = flags & CHECKPOINT_IDLE_ARRIVAL;
+        p->enqueued_ns = now - le64_to_cpu(rec[i].waited_ns);
+        snprintf(p->str, sizeof(p->str), "%c%d", type_initials[p->type], p->destination + 1);
+        p->submitter = restored;
+        p->has_eta = false;
+
+        if(flags & CHECKPOINT_ON_BOARD){
+            list_add_tail(&p->list, &elevator.passengers_on_board);
+            num_passengers++;
+            elevator.current_load += p->weight;
+            restored->outstanding++;
+            plan_add_rider(p);
+        }
+        else{
+            enqueue_waiting(p);
+        }
+    }
+
+    elevator.current_floor = le32_to_cpu(hdr->current_floor);
+    elevator.current_destination = le32_to_cpu(hdr->current_destination);
+    turn_off = le32_to_cpu(hdr->turn_off);
+    num_serviced = le32_to_cpu(hdr->num_serviced);
+    num_admitted = le64_to_cpu(hdr->num_admitted);
+    num_rejected = le64_to_cpu(hdr->num_rejected);
+    num_blocked = le64_to_cpu(hdr->num_blocked);
+    num_park_moves = le64_to_cpu(hdr->num_park_moves);
+    idle_pickup_count = le64_to_cpu(hdr->idle_pickup_count);
+    idle_pickup_total_ms = le64_to_cpu(hdr->idle_pickup_total_ms);
+    for(int prio = 0; prio < NUM_PRIORITIES; prio++){
+        wait_count[prio] = le64_to_cpu(hdr->wait_count[prio]);
+        wait_max_ms[prio] = le64_to_cpu(hdr->wait_max_ms[prio]);
+        for(int b = 0; b < WAIT_BUCKETS; b++)
+            wait_hist[prio][b] = le64_to_cpu(hdr->wait_hist[prio][b]);
+    }
+    for(int i = 0; i < NUM_FLOORS; i++){
+        floor_demand[i][DIR_UP] = le64_to_cpu(hdr->floor_demand[i][DIR_UP]);
+        floor_demand[i][DIR_DOWN] = le64_to_cpu(hdr->floor_demand[i][DIR_DOWN]);
+    }
+    demand_updated_ns = now;
+
+    // The car resumes from the floor it was checkpointed at
+    set_state(le32_to_cpu(hdr->state));
+    plan_direction = elevator.state == DOWN ? DIR_DOWN : DIR_UP;
+    elevator.phase = CAR_ARRIVED;
+    publish_snapshot();
+    if(elevator.state != OFFLINE)
+        mod_delayed_work(system_wq, &elevator.work, 0);
+    elevator_unlock();
+
+    printk(KERN_INFO "elevator: restored %u passengers from checkpoint", n);
     return 0;
 }
 
-static void __exit elevator_exit(void){
-    kthread_stop(elevator.kthread);
+static int checkpoint_open(struct inode *inode, struct file *file){
+    struct checkpoint_file *cf;
 
-    struct list_head *temp;
-	struct list_head *dummy;
-	Passenger *p;
+    if((file->f_mode & FMODE_READ) && (file->f_mode & FMODE_WRITE))
+        return -EINVAL;
 
-    if(num_passengers > 0){
-        list_for_each_safe(temp, dummy, &elevator.passengers_on_board){
-            p = list_entry(temp, Passenger, list);
+    cf = kzalloc(sizeof(*cf), GFP_KERNEL);
+    if(!cf)
+        return -ENOMEM;
 
-            list_del(temp);	
-            kfree(p);
+    if(file->f_mode & FMODE_READ){
+        cf->data = checkpoint_build(&cf->len);
+        if(!cf->data){
+            kfree(cf);
+            return -ENOMEM;
         }
     }
 
-    if(num_waiting > 0){
-        for(int i=0; i< NUM_FLOORS; i++){
-            if(!list_empty(&floors[elevator.current_floor].passengers_waiting)){
-                list_for_each_safe(temp, dummy, &floors[elevator.current_floor].passengers_waiting){
-                    p = list_entry(temp, Passenger, list);
+    file->private_data = cf;
+    return 0;
+}
 
-                    list_del(temp);	
-                    kfree(p);
-                }
-            }
+static ssize_t checkpoint_read(struct file *file, char __user *ubuf, size_t count, loff_t *ppos){
+    struct checkpoint_file *cf = file->private_data;
+
+    return simple_read_from_buffer(ubuf, count, ppos, cf->data, cf->len);
+}
+
+// The snapshot may arrive over several writes; it is applied once all of it is in
+static ssize_t checkpoint_write(struct file *file, const char __user *ubuf, size_t count, loff_t *ppos){
+    struct checkpoint_file *cf = file->private_data;
+    size_t expected = CHECKPOINT_MAX_SIZE;
+    int ret;
+
+    if(cf->restored)
+        return -EINVAL;
+    if(count > CHECKPOINT_MAX_SIZE - cf->len)
+        return -EFBIG;
+
+    if(cf->len + count > cf->cap){
+        size_t cap = max(cf->len + count, 2 * cf->cap);
+        void *data = kvmalloc(cap, GFP_KERNEL);
+
+        if(!data)
+            return -ENOMEM;
+        if(cf->data)
+            memcpy(data, cf->data, cf->len);
+        kvfree(cf->data);
+        cf->data = data;
+        cf->cap = cap;
+    }
+
+    if(copy_from_user(cf->data + cf->len, ubuf, count))
+        return -EFAULT;
+    cf->len += count;
+
+    if(cf->len >= sizeof(struct checkpoint_header))
+        expected = le32_to_cpu(((struct checkpoint_header *)cf->data)->size);
+    if(cf->len > expected)
+        return -EINVAL;
+    if(cf->len == expected){
+        ret = checkpoint_restore(cf->data, cf->len);
+        if(ret)
+            return ret;
+        cf->restored = true;
+    }
+
+    *ppos += count;
+    return count;
+}
+
+static int checkpoint_release(struct inode *inode, struct file *file){
+    struct checkpoint_file *cf = file->private_data;
+
+    kvfree(cf->data);
+    kfree(cf);
+    return 0;
+}
+
+static const struct proc_ops elevator_checkpoint_fops = {
+    .proc_open = checkpoint_open,
+    .proc_read = checkpoint_read,
+    .proc_write = checkpoint_write,
+    .proc_release = checkpoint_release,
+};
+
+static int __init elevator_init(void){
+    int ret = -ENOMEM;
+
+    mutex_init(&elevator.mutex);
+
+    elevator.state = OFFLINE;
+    elevator.phase = CAR_IDLE;
+    INIT_LIST_HEAD(&elevator.passengers_on_board);
+    INIT_DELAYED_WORK(&elevator.work, elevator_work);
+
+    for(int i=0; i<NUM_FLOORS; i++){
+        floors[i].num_waiting_floor = 0;
+        for(int prio = 0; prio < NUM_PRIORITIES; prio++)
+            INIT_LIST_HEAD(&floors[i].passengers_waiting[prio]);
+        INIT_LIST_HEAD(&floors[i].rr);
+    }
+
+    num_passengers = 0;
+    num_serviced = 0;
+    num_waiting = 0;
+    demand_updated_ns = ktime_get_ns();
+
+    mutex_lock(&elevator.mutex);
+    publish_snapshot();
+    mutex_unlock(&elevator.mutex);
+    if (!rcu_access_pointer(elevator_snap)) {
+        return -ENOMEM;
+    }
+
+    elevator_entry = proc_create(ENTRY_NAME, PERMS, PARENT, &elevator_fops);
+    if (!elevator_entry)
+        goto err_snapshot;
+
+    stats_entry = proc_create(STATS_ENTRY_NAME, PERMS, PARENT, &elevator_stats_fops);
+    if (!stats_entry)
+        goto err_elevator_entry;
+
+    checkpoint_entry = proc_create(CHECKPOINT_ENTRY_NAME, CHECKPOINT_PERMS, PARENT, &elevator_checkpoint_fops);
+    if (!checkpoint_entry)
+        goto err_stats_entry;
+
+    bin_entry = proc_create(BIN_ENTRY_NAME, PERMS, PARENT, &elevator_bin_fops);
+    if (!bin_entry)
+        goto err_checkpoint_entry;
+
+    json_entry = proc_create(JSON_ENTRY_NAME, PERMS, PARENT, &elevator_json_fops);
+    if (!json_entry)
+        goto err_bin_entry;
+
+    ret = genl_register_family(&elevator_genl_family);
+    if (ret)
+        goto err_json_entry;
+
+    // The syscalls and then /dev/elevator come last, so requests only reach a
+    // fully set up module. Stock kernels lack the syscalls, and the module is
+    // then driven through /dev/elevator.
+    syscalls_unregister = symbol_get(elevator_syscalls_unregister);
+    if (syscalls_unregister) {
+        int (*syscalls_register)(int (*)(void), int (*)(int,int,int), int (*)(void), int (*)(struct elevator_eta __user *));
+
+        syscalls_register = symbol_get(elevator_syscalls_register);
+        ret = syscalls_register ? syscalls_register(start_elevator, issue_request, stop_elevator, elevator_eta) : -ENOENT;
+        if (syscalls_register)
+            symbol_put(elevator_syscalls_register);
+        if (ret) {
+            symbol_put(elevator_syscalls_unregister);
+            goto err_genl;
         }
     }
+    else {
+        printk(KERN_INFO "elevator: no elevator syscalls in this kernel, use /dev/%s", ENTRY_NAME);
+    }
+
+    ret = misc_register(&elevator_dev);
+    if (ret)
+        goto err_syscalls;
+
+    // Debug only, so failing to create these is not an error
+    debugfs_dir = debugfs_create_dir(ENTRY_NAME, NULL);
+    debugfs_create_file("lock_stats", 0400, debugfs_dir, NULL, &lock_stats_fops);
+    debugfs_create_file("lock_stats_reset", 0200, debugfs_dir, NULL, &lock_stats_reset_fops);
+
+    return 0;
 
+err_syscalls:
+    if (syscalls_unregister) {
+        mutex_lock(&elevator.mutex);
+        turn_off = true;
+        mutex_unlock(&elevator.mutex);
+        wake_up_interruptible_all(&admission_wq);
+        syscalls_unregister();
+        symbol_put(elevator_syscalls_unregister);
+    }
+err_genl:
+    // Stop the car before its events lose their family; frozen also turns away restores
+    mutex_lock(&elevator.mutex);
+    frozen = true;
+    mutex_unlock(&elevator.mutex);
+    cancel_delayed_work_sync(&elevator.work);
+    genl_unregister_family(&elevator_genl_family);
+err_json_entry:
+    proc_remove(json_entry);
+err_bin_entry:
+    proc_remove(bin_entry);
+err_checkpoint_entry:
+    proc_remove(checkpoint_entry);
+err_stats_entry:
+    proc_remove(stats_entry);
+err_elevator_entry:
+    proc_remove(elevator_entry);
+    // Passengers may already have come in through the syscalls or a checkpoint restore
+    cancel_delayed_work_sync(&elevator.work);
+    mutex_lock(&elevator.mutex);
+    free_all_state();
+    mutex_unlock(&elevator.mutex);
+err_snapshot:
+    snapshot_put(rcu_dereference_protected(elevator_snap, 1));
+    rcu_barrier();
+    return ret;
+}
+
+static void __exit elevator_exit(void){
+    debugfs_remove_recursive(debugfs_dir);
+
+    // Close admission first: submitters blocked for room are inside the syscall
+    // and would otherwise hold up the unregister below until the car frees a slot
+    mutex_lock(&elevator.mutex);
+    turn_off = true;
+    mutex_unlock(&elevator.mutex);
+    wake_up_interruptible_all(&admission_wq);
+
+    // Returns once no syscall is still running module code
+    if (syscalls_unregister) {
+        syscalls_unregister();
+        symbol_put(elevator_syscalls_unregister);
+    }
+    misc_deregister(&elevator_dev);
+
+    remove_proc_entry(JSON_ENTRY_NAME, NULL);
+    remove_proc_entry(BIN_ENTRY_NAME, NULL);
+    remove_proc_entry(CHECKPOINT_ENTRY_NAME, NULL);
+    remove_proc_entry(STATS_ENTRY_NAME, NULL);
     remove_proc_entry(ENTRY_NAME, NULL);
+
+    // Nothing can kick the car any more, so it stays stopped once cancelled
+    cancel_delayed_work_sync(&elevator.work);
+    genl_unregister_family(&elevator_genl_family);
+
+    mutex_lock(&elevator.mutex);
+    free_all_state();
+    snapshot_put(rcu_dereference_protected(elevator_snap, lockdep_is_held(&elevator.mutex)));
+    RCU_INIT_POINTER(elevator_snap, NULL);
+    mutex_unlock(&elevator.mutex);
+
+    // Wait for pending kfree_rcu() callbacks before the module goes away
+    rcu_barrier();
     mutex_destroy(&elevator.mutex);
 }
 
@@ -0,0 +1,160 @@
+#ifndef __ELEVATOR_UAPI_H
+#define __ELEVATOR_UAPI_H
+
+/*
+ * Layouts shared between the elevator module and userspace tools.
+ */
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+// Elevator states as reported in the binary view
+#define ELEVATOR_OFFLINE 0
+#define ELEVATOR_IDLE 1
+#define ELEVATOR_LOADING 2
+#define ELEVATOR_UP 3
+#define ELEVATOR_DOWN 4
+
+// Passenger types, as passed to issue_request
+#define ELEVATOR_PART_TIME 0
+#define ELEVATOR_LAWYER 1
+#define ELEVATOR_BOSS 2
+#define ELEVATOR_VISITOR 3
+
+/*
+ * /proc/elevator_bin: one struct elevator_bin_header followed by num_records
+ * struct elevator_bin_passenger, riders first, then the waiting passengers of
+ * floor 1..num_floors in boarding order. floor_count[0] is the number of riders,
+ * floor_count[i] the number waiting on floor i. All fields are little-endian;
+ * floors are 1-based.
+ */
+#define ELEVATOR_BIN_MAGIC 0x42564c45
+#define ELEVATOR_BIN_VERSION 1
+#define ELEVATOR_BIN_MAX_FLOORS 8
+
+struct elevator_bin_header {
+    __le32 magic;
+    __le32 version;
+    __le32 size;
+    __le32 record_size;
+    __le64 generation;
+    __le64 timestamp_ns;
+    __le32 state;
+    __le32 current_floor;
+    __le32 current_load;
+    __le32 num_passengers;
+    __le32 num_waiting;
+    __le32 num_serviced;
+    __le64 num_admitted;
+    __le64 num_rejected;
+    __le64 num_blocked;
+    __le32 num_floors;
+    __le32 num_records;
+    __le32 floor_count[ELEVATOR_BIN_MAX_FLOORS + 1];
+    __le32 reserved;
+};
+
+struct elevator_bin_passenger {
+    __u8 type;
+    __u8 start;
+    __u8 destination;
+    __u8 priority;
+    __le32 reserved;
+    __le64 age_ns;
+};
+
+/*
+ * /dev/elevator ioctls, for kernels without the elevator syscalls. START,
+ * STOP and REQUEST return what the matching syscall would. BATCH submits
+ * count requests from the user array at requests, stores each result and
+ * returns the number processed. ETA is the elevator_eta syscall: it predicts
+ * the wait and ride of a request without making it, and fails with ENODEV
+ * while the elevator is offline or stopping.
+ */
+#define ELEVATOR_DEVICE "/dev/elevator"
+#define ELEVATOR_IOC_MAGIC 'E'
+
+struct elevator_request {
+    __s32 start;
+    __s32 dest;
+    __s32 type;
+    __s32 result;
+};
+
+struct elevator_batch {
+    __u64 requests;
+    __u32 count;
+    __u32 done;
+};
+
+struct elevator_stats {
+    __u32 state;
+    __u32 current_floor;
+    __u32 current_load;
+    __u32 num_passengers;
+    __u32 num_waiting;
+    __u32 num_serviced;
+    __u64 num_admitted;
+    __u64 num_rejected;
+    __u64 num_blocked;
+    __u64 generation;
+};
+
+// start, dest and type as for a request; wait_ms until boarded, ride_ms from boarding to dest
+struct elevator_eta {
+    __u32 start;
+    __u32 dest;
+    __u32 type;
+    __u32 wait_ms;
+    __u32 ride_ms;
+    __u32 reserved;
+};
+
+#define ELEVATOR_IOC_START _IO(ELEVATOR_IOC_MAGIC, 1)
+#define ELEVATOR_IOC_STOP _IO(ELEVATOR_IOC_MAGIC, 2)
+#define ELEVATOR_IOC_REQUEST _IOW(ELEVATOR_IOC_MAGIC, 3, struct elevator_request)
+#define ELEVATOR_IOC_BATCH _IOWR(ELEVATOR_IOC_MAGIC, 4, struct elevator_batch)
+#define ELEVATOR_IOC_STATS _IOR(ELEVATOR_IOC_MAGIC, 5, struct elevator_stats)
+#define ELEVATOR_IOC_ETA _IOWR(ELEVATOR_IOC_MAGIC, 6, struct elevator_eta)
+
+/*
+ * Generic netlink family ELEVATOR_GENL_NAME multicasts one ELEVATOR_CMD_EVENT
+ * message per event to the ELEVATOR_GENL_MCGRP group. The message carries a
+ * single ELEVATOR_ATTR_EVENT attribute holding a struct elevator_event in host
+ * byte order. Floors and destinations are 1-based.
+ */
+#define ELEVATOR_GENL_NAME "elevator"
+#define ELEVATOR_GENL_VERSION 1
+#define ELEVATOR_GENL_MCGRP "events"
+
+enum {
+    ELEVATOR_CMD_UNSPEC,
+    ELEVATOR_CMD_EVENT,
+};
+
+enum {
+    ELEVATOR_ATTR_UNSPEC,
+    ELEVATOR_ATTR_EVENT,
+    __ELEVATOR_ATTR_MAX,
+};
+#define ELEVATOR_ATTR_MAX (__ELEVATOR_ATTR_MAX - 1)
+
+enum {
+    ELEVATOR_EVENT_STATE,        // state changed, see state
+    ELEVATOR_EVENT_ARRIVAL,      // car reached floor
+    ELEVATOR_EVENT_BOARD,        // passenger boarded at floor
+    ELEVATOR_EVENT_DELIVER,      // passenger got off at floor
+    ELEVATOR_EVENT_QUEUE_DEPTH,  // floor queue crossed the threshold, now queue_depth
+};
+
+struct elevator_event {
+    __u32 type;
+    __u32 state;
+    __u32 floor;
+    __u32 passenger_type;
+    __u32 destination;
+    __u32 queue_depth;
+    __u64 timestamp_ns;
+};
+
+#endif
@@ -1,4 +1,28 @@
 #include "wrappers.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+
+static int elevator_fd = -1;
+static int have_syscalls = 1;
+
+// Opened on first use once the syscalls turn out to be missing
+static int elevator_device() {
+    if (elevator_fd < 0)
+        elevator_fd = open(ELEVATOR_DEVICE, O_RDWR | O_CLOEXEC);
+    if (elevator_fd < 0)
+        errno = ENOSYS;
+    return elevator_fd;
+}
+
+// A syscall result that means this kernel does not have the elevator syscalls
+static int missing_syscall(long ret) {
+    if (ret == -1 && errno == ENOSYS && elevator_device() >= 0) {
+        have_syscalls = 0;
+        return 1;
+    }
+    return 0;
+}
 
 int start_elevator() {
     /*
@@ -6,7 +30,12 @@ int start_elevator() {
     Current Floor = 1
     Current Load = 0
     */
-    return syscall(__NR_START_ELEVATOR);
+    if (have_syscalls) {
+        long ret = syscall(__NR_START_ELEVATOR);
+        if (!missing_syscall(ret))
+            return ret;
+    }
+    return ioctl(elevator_fd, ELEVATOR_IOC_START);
 }
 
 int issue_request(int start, int dest, int type) {
@@ -16,12 +45,66 @@ int issue_request(int start, int dest, int type) {
 
         current_waiting ++;
     */
-    return syscall(__NR_ISSUE_REQUEST, start, dest, type);
+    if (have_syscalls) {
+        long ret = syscall(__NR_ISSUE_REQUEST, start, dest, type);
+        if (!missing_syscall(ret))
+            return ret;
+    }
+
+    struct elevator_request request = { .start = start, .dest = dest, .type = type };
+    return ioctl(elevator_fd, ELEVATOR_IOC_REQUEST, &request);
+}
+
+int issue_request_priority(int start, int dest, int type, int priority) {
+    /*
+        Same as issue_request, but boards in the given priority class
+        instead of the default one for the passenger type.
+    */
+    return issue_request(start, dest, type | ((priority + 1) << PRIORITY_SHIFT));
+}
+
+int issue_requests(struct elevator_request *requests, int count) {
+    /*
+        Submits count requests in one call through /dev/elevator, storing
+        each one's result. Returns how many were processed.
+    */
+    struct elevator_batch batch = { .requests = (unsigned long)requests, .count = count };
+
+    if (elevator_device() < 0)
+        return -1;
+    return ioctl(elevator_fd, ELEVATOR_IOC_BATCH, &batch);
 }
 
 int stop_elevator() {
     /*
         Stop = true
     */
-    return syscall(__NR_STOP_ELEVATOR);
+    if (have_syscalls) {
+        long ret = syscall(__NR_STOP_ELEVATOR);
+        if (!missing_syscall(ret))
+            return ret;
+    }
+    return ioctl(elevator_fd, ELEVATOR_IOC_STOP);
+}
+
+int get_elevator_stats(struct elevator_stats *stats) {
+    if (elevator_device() < 0)
+        return -1;
+    return ioctl(elevator_fd, ELEVATOR_IOC_STATS, stats);
+}
+
+int predict_eta(int start, int dest, int type, struct elevator_eta *eta) {
+    /*
+        Fills eta->wait_ms and eta->ride_ms with the predicted time until
+        pickup and from pickup to dest, without issuing the request.
+    */
+    eta->start = start;
+    eta->dest = dest;
+    eta->type = type;
+    if (have_syscalls) {
+        long ret = syscall(__NR_ELEVATOR_ETA, eta);
+        if (!missing_syscall(ret))
+            return ret;
+    }
+    return ioctl(elevator_fd, ELEVATOR_IOC_ETA, eta);
 }
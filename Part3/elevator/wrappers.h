@@ -4,13 +4,31 @@
 #define _GNU_SOURCE
 #include <unistd.h>
 #include <sys/syscall.h>
+#include "elevator_uapi.h"
 
 #define __NR_START_ELEVATOR 548
 #define __NR_ISSUE_REQUEST 549
 #define __NR_STOP_ELEVATOR 550
+#define __NR_ELEVATOR_ETA 551
 
+// Boarding priority classes, higher boards first
+#define PRIO_LOW 0
+#define PRIO_NORMAL 1
+#define PRIO_HIGH 2
+
+// Explicit priority is encoded in the type argument above this shift
+#define PRIORITY_SHIFT 8
+
+/*
+ * Each call uses the elevator syscalls when the kernel has them and falls back
+ * to the /dev/elevator ioctls otherwise.
+ */
 int start_elevator();
 int issue_request(int start, int dest, int type);
+int issue_request_priority(int start, int dest, int type, int priority);
+int issue_requests(struct elevator_request *requests, int count);
 int stop_elevator();
+int get_elevator_stats(struct elevator_stats *stats);
+int predict_eta(int start, int dest, int type, struct elevator_eta *eta);
 
 #endif
@@ -0,0 +1,110 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include "../../elevator/elevator_uapi.h"
+
+#define __NR_ELEVATOR_ETA 551
+
+static int start, dest, type;
+static int elevator_fd = -1;
+static volatile int done;
+
+struct worker {
+	pthread_t thread;
+	unsigned long queries, errors;
+	unsigned long long total_ns, max_ns;
+};
+
+static unsigned long long now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// The syscall when the kernel has it, else the /dev/elevator ioctl
+static int query(struct elevator_eta *eta) {
+	eta->start = start;
+	eta->dest = dest;
+	eta->type = type;
+	if (elevator_fd < 0) {
+		long ret = syscall(__NR_ELEVATOR_ETA, eta);
+		if (ret != -1 || errno != ENOSYS)
+			return ret;
+		elevator_fd = open(ELEVATOR_DEVICE, O_RDWR | O_CLOEXEC);
+		if (elevator_fd < 0)
+			return -1;
+	}
+	return ioctl(elevator_fd, ELEVATOR_IOC_ETA, eta);
+}
+
+static void *query_loop(void *arg) {
+	struct worker *w = arg;
+	struct elevator_eta eta;
+
+	while (!done) {
+		unsigned long long t0 = now_ns(), t;
+
+		if (query(&eta) != 0)
+			w->errors++;
+		t = now_ns() - t0;
+		w->total_ns += t;
+		if (t > w->max_ns)
+			w->max_ns = t;
+		w->queries++;
+	}
+	return NULL;
+}
+
+int main(int argc, char *argv[]) {
+	struct elevator_eta eta;
+	struct worker *workers;
+	unsigned long long total_ns = 0, max_ns = 0;
+	unsigned long queries = 0, errors = 0;
+	int threads, seconds;
+
+	if (argc < 4) {
+		printf("usage: %s start dest type [threads seconds]\n", argv[0]);
+		return 1;
+	}
+	start = atoi(argv[1]);
+	dest = atoi(argv[2]);
+	type = atoi(argv[3]);
+	threads = argc > 4 ? atoi(argv[4]) : 0;
+	seconds = argc > 5 ? atoi(argv[5]) : 5;
+
+	if (query(&eta) != 0) {
+		perror("elevator_eta");
+		return 1;
+	}
+	printf("floor %d -> %d: pickup in %u.%03us, arrival %u.%03us later\n", start, dest,
+	       eta.wait_ms / 1000, eta.wait_ms % 1000, eta.ride_ms / 1000, eta.ride_ms % 1000);
+	if (threads <= 0)
+		return 0;
+
+	// Concurrent queries, to check they stay cheap while others run
+	workers = calloc(threads, sizeof(*workers));
+	for (int i = 0; i < threads; i++)
+		pthread_create(&workers[i].thread, NULL, query_loop, &workers[i]);
+	sleep(seconds);
+	done = 1;
+	for (int i = 0; i < threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		queries += workers[i].queries;
+		errors += workers[i].errors;
+		total_ns += workers[i].total_ns;
+		if (workers[i].max_ns > max_ns)
+			max_ns = workers[i].max_ns;
+	}
+	printf("%d threads: %lu queries (%lu/s), %lu errors, mean %lluns, max %lluns\n", threads, queries,
+	       queries / seconds, errors, queries ? total_ns / queries : 0, max_ns);
+	free(workers);
+	return 0;
+}
@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+#include "../../elevator/elevator_uapi.h"
+
+#define BUF_SIZE 8192
+
+static const char *states[] = {"OFFLINE", "IDLE", "LOADING", "UP", "DOWN"};
+static const char *events[] = {"state", "arrival", "board", "deliver", "queue_depth"};
+
+static unsigned long long now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Ask the generic netlink controller for the family id and the events group id
+static int resolve_family(int fd, int *family, int *group) {
+	char buf[BUF_SIZE];
+	struct nlmsghdr *nlh = (void *)buf;
+	struct genlmsghdr *genl;
+	struct nlattr *nla;
+	int len, rem;
+
+	memset(buf, 0, sizeof(buf));
+	nlh->nlmsg_type = GENL_ID_CTRL;
+	nlh->nlmsg_flags = NLM_F_REQUEST;
+	genl = NLMSG_DATA(nlh);
+	genl->cmd = CTRL_CMD_GETFAMILY;
+	genl->version = 1;
+	nla = (void *)((char *)genl + GENL_HDRLEN);
+	nla->nla_type = CTRL_ATTR_FAMILY_NAME;
+	nla->nla_len = NLA_HDRLEN + sizeof(ELEVATOR_GENL_NAME);
+	memcpy((char *)nla + NLA_HDRLEN, ELEVATOR_GENL_NAME, sizeof(ELEVATOR_GENL_NAME));
+	nlh->nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN + NLA_ALIGN(nla->nla_len));
+
+	if (send(fd, buf, nlh->nlmsg_len, 0) < 0)
+		return -1;
+	len = recv(fd, buf, sizeof(buf), 0);
+	if (len < 0 || !NLMSG_OK(nlh, len) || nlh->nlmsg_type == NLMSG_ERROR)
+		return -1;
+
+	*family = *group = -1;
+	genl = NLMSG_DATA(nlh);
+	nla = (void *)((char *)genl + GENL_HDRLEN);
+	rem = nlh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+	for (; rem >= NLA_HDRLEN && nla->nla_len <= rem;
+	     rem -= NLA_ALIGN(nla->nla_len), nla = (void *)((char *)nla + NLA_ALIGN(nla->nla_len))) {
+		if (nla->nla_type == CTRL_ATTR_FAMILY_ID) {
+			*family = *(unsigned short *)((char *)nla + NLA_HDRLEN);
+		} else if ((nla->nla_type & NLA_TYPE_MASK) == CTRL_ATTR_MCAST_GROUPS) {
+			// Nested list of groups, each a nest of name and id
+			struct nlattr *grp = (void *)((char *)nla + NLA_HDRLEN);
+			int grem = nla->nla_len - NLA_HDRLEN;
+
+			for (; grem >= NLA_HDRLEN && grp->nla_len <= grem;
+			     grem -= NLA_ALIGN(grp->nla_len), grp = (void *)((char *)grp + NLA_ALIGN(grp->nla_len))) {
+				struct nlattr *a = (void *)((char *)grp + NLA_HDRLEN);
+				int arem = grp->nla_len - NLA_HDRLEN, id = -1;
+				const char *name = NULL;
+
+				for (; arem >= NLA_HDRLEN && a->nla_len <= arem;
+				     arem -= NLA_ALIGN(a->nla_len), a = (void *)((char *)a + NLA_ALIGN(a->nla_len))) {
+					if (a->nla_type == CTRL_ATTR_MCAST_GRP_ID)
+						id = *(unsigned int *)((char *)a + NLA_HDRLEN);
+					else if (a->nla_type == CTRL_ATTR_MCAST_GRP_NAME)
+						name = (char *)a + NLA_HDRLEN;
+				}
+				if (name && !strcmp(name, ELEVATOR_GENL_MCGRP))
+					*group = id;
+			}
+		}
+	}
+	return (*family < 0 || *group < 0) ? -1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+	struct sockaddr_nl addr = { .nl_family = AF_NETLINK };
+	unsigned long long count = 0, total_latency = 0, max_latency = 0;
+	long limit = argc > 1 ? atol(argv[1]) : 0;
+	char buf[BUF_SIZE];
+	int fd, family, group;
+
+	fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_GENERIC);
+	if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("netlink");
+		return 1;
+	}
+	if (resolve_family(fd, &family, &group) < 0) {
+		fprintf(stderr, "%s family not found, is the elevator module loaded?\n", ELEVATOR_GENL_NAME);
+		return 1;
+	}
+	if (setsockopt(fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, &group, sizeof(group)) < 0) {
+		perror("NETLINK_ADD_MEMBERSHIP");
+		return 1;
+	}
+	printf("listening on %s/%s (family %d, group %d)\n", ELEVATOR_GENL_NAME, ELEVATOR_GENL_MCGRP, family, group);
+
+	while (!limit || count < (unsigned long long)limit) {
+		int len = recv(fd, buf, sizeof(buf), 0);
+		struct nlmsghdr *nlh = (void *)buf;
+
+		if (len < 0) {
+			perror("recv");
+			break;
+		}
+		for (; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+			struct nlattr *nla = (void *)((char *)NLMSG_DATA(nlh) + GENL_HDRLEN);
+			struct elevator_event ev;
+			unsigned long long latency;
+
+			if (nlh->nlmsg_type != family || nla->nla_type != ELEVATOR_ATTR_EVENT ||
+			    nla->nla_len < NLA_HDRLEN + sizeof(ev))
+				continue;
+			memcpy(&ev, (char *)nla + NLA_HDRLEN, sizeof(ev));
+
+			// Kernel stamps events with ktime_get_ns(), the same clock as CLOCK_MONOTONIC
+			latency = now_ns() - ev.timestamp_ns;
+			total_latency += latency;
+			if (latency > max_latency)
+				max_latency = latency;
+			count++;
+
+			printf("%-11s state=%-7s floor=%u", ev.type <= ELEVATOR_EVENT_QUEUE_DEPTH ? events[ev.type] : "?",
+			       ev.state <= ELEVATOR_DOWN ? states[ev.state] : "?", ev.floor);
+			if (ev.type == ELEVATOR_EVENT_BOARD || ev.type == ELEVATOR_EVENT_DELIVER)
+				printf(" type=%u dest=%u", ev.passenger_type, ev.destination);
+			if (ev.type == ELEVATOR_EVENT_QUEUE_DEPTH || ev.type == ELEVATOR_EVENT_BOARD)
+				printf(" depth=%u", ev.queue_depth);
+			printf(" latency=%lluus\n", latency / 1000);
+		}
+	}
+
+	if (count)
+		printf("%llu events, mean latency %lluus, max %lluus\n", count, total_latency / count / 1000,
+		       max_latency / 1000);
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#define ELEVATOR_PROC "/proc/elevator"
+#define STATS_PROC "/proc/elevator_stats"
+
+static volatile int done;
+
+static void *read_loop(void *arg) {
+	unsigned long *reads = arg;
+	char buf[16384];
+	int fd;
+
+	while (!done) {
+		fd = open(ELEVATOR_PROC, O_RDONLY);
+		if (fd < 0) {
+			perror("open " ELEVATOR_PROC);
+			return NULL;
+		}
+		while (read(fd, buf, sizeof(buf)) > 0)
+			;
+		close(fd);
+		(*reads)++;
+	}
+	return NULL;
+}
+
+static void print_cache_stats(void) {
+	char line[256];
+	FILE *f = fopen(STATS_PROC, "r");
+
+	if (f == NULL)
+		return;
+	while (fgets(line, sizeof(line), f))
+		if (strncmp(line, "Render cache:", 13) == 0)
+			printf("%s", line);
+	fclose(f);
+}
+
+int main(int argc, char **argv) {
+	pthread_t *threads;
+	unsigned long *reads;
+	unsigned long total = 0;
+	int num, seconds;
+	int i;
+
+	if (argc != 3) {
+		printf("wrong number of args. reader num_of_readers seconds\n");
+		return -1;
+	}
+	sscanf(argv[1], "%d", &num);
+	sscanf(argv[2], "%d", &seconds);
+	if (num < 1 || seconds < 1)
+		return -1;
+
+	threads = calloc(num, sizeof(*threads));
+	reads = calloc(num, sizeof(*reads));
+
+	print_cache_stats();
+	for (i = 0; i < num; i++)
+		pthread_create(&threads[i], NULL, read_loop, &reads[i]);
+	sleep(seconds);
+	done = 1;
+	for (i = 0; i < num; i++) {
+		pthread_join(threads[i], NULL);
+		total += reads[i];
+	}
+
+	printf("%d readers, %d s: %lu reads, %.0f reads/s\n", num, seconds, total, (double)total / seconds);
+	print_cache_stats();
+
+	free(threads);
+	free(reads);
+	return 0;
+}
@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <endian.h>
+#include "../../elevator/elevator_uapi.h"
+
+#define BIN_PROC "/proc/elevator_bin"
+#define BUF_SIZE (1 << 20)
+#define MAX_RIDERS 64
+
+struct decoded {
+	unsigned long long generation;
+	unsigned int state, floor, load, passengers, waiting, serviced;
+	unsigned int num_floors, num_records;
+	unsigned int floor_count[ELEVATOR_BIN_MAX_FLOORS + 1];
+	unsigned int num_riders;
+	unsigned char rider_dest[MAX_RIDERS];
+	unsigned long long oldest_age_ns;
+};
+
+static const char *states[] = {"OFFLINE", "IDLE", "LOADING", "UP", "DOWN"};
+
+static int decode(const char *buf, size_t len, struct decoded *d) {
+	const struct elevator_bin_header *hdr = (const void *)buf;
+	const struct elevator_bin_passenger *rec;
+	unsigned int i;
+
+	if (len < sizeof(*hdr) || le32toh(hdr->magic) != ELEVATOR_BIN_MAGIC ||
+	    le32toh(hdr->version) != ELEVATOR_BIN_VERSION || le32toh(hdr->size) != len ||
+	    le32toh(hdr->record_size) != sizeof(*rec))
+		return -1;
+
+	d->generation = le64toh(hdr->generation);
+	d->state = le32toh(hdr->state);
+	d->floor = le32toh(hdr->current_floor);
+	d->load = le32toh(hdr->current_load);
+	d->passengers = le32toh(hdr->num_passengers);
+	d->waiting = le32toh(hdr->num_waiting);
+	d->serviced = le32toh(hdr->num_serviced);
+	d->num_floors = le32toh(hdr->num_floors);
+	d->num_records = le32toh(hdr->num_records);
+	if (d->num_floors > ELEVATOR_BIN_MAX_FLOORS || d->floor < 1 || d->floor > d->num_floors ||
+	    len != sizeof(*hdr) + (size_t)d->num_records * sizeof(*rec))
+		return -1;
+	for (i = 0; i <= d->num_floors; i++)
+		d->floor_count[i] = le32toh(hdr->floor_count[i]);
+
+	d->oldest_age_ns = 0;
+	rec = (const void *)(hdr + 1);
+	for (i = 0; i < d->num_records; i++)
+		if (le64toh(rec[i].age_ns) > d->oldest_age_ns)
+			d->oldest_age_ns = le64toh(rec[i].age_ns);
+
+	// Riders come first; floor_count[0] of them
+	d->num_riders = d->floor_count[0] < MAX_RIDERS ? d->floor_count[0] : MAX_RIDERS;
+	if (d->num_riders > d->num_records)
+		return -1;
+	for (i = 0; i < d->num_riders; i++)
+		d->rider_dest[i] = rec[i].destination;
+	return 0;
+}
+
+/*
+ * A delivery happens at the end of a door dwell, and the car stays on that
+ * floor for at least one more dwell or move, so when num_serviced goes up
+ * between two reads, one of the previous riders must have been going to the
+ * floor the car now reports. Returns 0 if so (or nothing was delivered).
+ */
+static int check_delivery(const struct decoded *prev, const struct decoded *d) {
+	unsigned int i;
+
+	if (d->serviced <= prev->serviced || d->generation <= prev->generation)
+		return 0;
+	for (i = 0; i < prev->num_riders; i++)
+		if (prev->rider_dest[i] == d->floor)
+			return 0;
+	return -1;
+}
+
+static double now_sec(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+	struct decoded d = { 0 }, prev;
+	unsigned long mismatches = 0;
+	char *buf;
+	ssize_t len;
+	double start, elapsed;
+	int iterations = 100000;
+	int fd, i;
+
+	if (argc > 2) {
+		printf("wrong number of args. snapshot_reader [iterations]\n");
+		return -1;
+	}
+	if (argc == 2 && (sscanf(argv[1], "%d", &iterations) != 1 || iterations < 1)) {
+		printf("iterations must be at least 1\n");
+		return -1;
+	}
+
+	buf = malloc(BUF_SIZE);
+	fd = open(BIN_PROC, O_RDONLY);
+	if (buf == NULL || fd < 0) {
+		perror("open " BIN_PROC);
+		return -1;
+	}
+
+	start = now_sec();
+	for (i = 0; i < iterations; i++) {
+		prev = d;
+		len = pread(fd, buf, BUF_SIZE, 0);
+		if (len < 0 || decode(buf, len, &d) < 0) {
+			printf("bad snapshot after %d reads\n", i);
+			return -1;
+		}
+		if (i > 0 && check_delivery(&prev, &d) < 0) {
+			printf("generation %llu: delivered at floor %u, but no rider was going there\n",
+			       d.generation, d.floor);
+			mismatches++;
+		}
+	}
+	elapsed = now_sec() - start;
+
+	printf("%d snapshots in %.3f s: %.0f snapshots/s\n", iterations, elapsed, iterations / elapsed);
+	printf("generation %llu: %s, floor %u, load %u, %u riding, %u waiting, %u serviced, oldest %.1f s\n",
+	       d.generation, d.state < 5 ? states[d.state] : "unknown", d.floor, d.load,
+	       d.passengers, d.waiting, d.serviced, d.oldest_age_ns / 1e9);
+	for (i = 1; i <= (int)d.num_floors; i++)
+		printf("floor %d: %u waiting\n", i, d.floor_count[i]);
+
+	close(fd);
+	free(buf);
+	if (mismatches) {
+		printf("%lu deliveries did not match the car floor\n", mismatches);
+		return -1;
+	}
+	return 0;
+}
@@ -10,10 +10,12 @@ MODULE_VERSION("0.1");
 int start_elevator(void);                                                           // starts the elevator to pick up and drop off passengers
 int issue_request(int start_floor, int destination_floor, int type);                // add passengers requests to specific floors
 int stop_elevator(void);                                                            // stops the elevator
+struct elevator_eta;
+int elevator_eta(struct elevator_eta __user *eta);                                  // predicts wait and ride of a request
 
-extern int (*STUB_start_elevator)(void);
-extern int (*STUB_issue_request)(int,int,int);
-extern int (*STUB_stop_elevator)(void);
+extern int elevator_syscalls_register(int (*start)(void), int (*issue)(int,int,int), int (*stop)(void),
+                                      int (*eta)(struct elevator_eta __user *));
+extern void elevator_syscalls_unregister(void);
 
 int start_elevator(void) {
     return 0;
@@ -27,17 +29,16 @@ int stop_elevator(void) {
     return 0;
 }
 
+int elevator_eta(struct elevator_eta __user *eta) {
+    return 0;
+}
+
 static int __init syscheck_init(void) {
-    STUB_start_elevator = start_elevator;
-	STUB_issue_request = issue_request;
-	STUB_stop_elevator = stop_elevator;
-    return 0;  // Return 0 to indicate successful loading
+    return elevator_syscalls_register(start_elevator, issue_request, stop_elevator, elevator_eta);  // Return 0 to indicate successful loading
 }
 
 static void __exit syscheck_exit(void) {
-    STUB_start_elevator = NULL;
-	STUB_issue_request = NULL;
-	STUB_stop_elevator = NULL;
+    elevator_syscalls_unregister();
 }
 
 module_init(syscheck_init);  // Specify the initialization function
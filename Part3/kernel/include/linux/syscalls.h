@@ -3,3 +3,9 @@
 asmlinkage int sys_start_elevator(void);
 asmlinkage int sys_issue_request(int, int,int);
 asmlinkage int sys_stop_elevator(void);
+struct elevator_eta;
+asmlinkage int sys_elevator_eta(struct elevator_eta __user *);
+
+int elevator_syscalls_register(int (*start)(void), int (*issue)(int,int,int), int (*stop)(void),
+                               int (*eta)(struct elevator_eta __user *));
+void elevator_syscalls_unregister(void);
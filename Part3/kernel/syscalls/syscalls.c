@@ -2,35 +2,105 @@
 #include <linux/kernel.h>
 #include <linux/module.h>
 #include <linux/syscalls.h>
+#include <linux/static_call.h>
+#include <linux/srcu.h>
+#include <linux/mutex.h>
 
-int (*STUB_start_elevator)(void) = NULL;
-int (*STUB_issue_request)(int,int,int) = NULL;
-int (*STUB_stop_elevator)(void) = NULL;
+/*
+ * The elevator module installs its handlers as static call targets, so each
+ * syscall is a direct call instead of a load of a mutable pointer followed by
+ * a retpolined indirect call. Calls run inside an SRCU read section, and
+ * unregistering waits for calls in flight, so the module text cannot go away
+ * under a caller.
+ */
+static int elevator_start_enosys(void) {
+  return -ENOSYS;
+}
+
+static int elevator_issue_enosys(int start_floor, int destination_floor, int type) {
+  return -ENOSYS;
+}
 
-EXPORT_SYMBOL(STUB_start_elevator);
-EXPORT_SYMBOL(STUB_stop_elevator);
-EXPORT_SYMBOL(STUB_issue_request);
+static int elevator_stop_enosys(void) {
+  return -ENOSYS;
+}
+
+static int elevator_eta_enosys(struct elevator_eta __user *eta) {
+  return -ENOSYS;
+}
+
+DEFINE_STATIC_CALL(elevator_start, elevator_start_enosys);
+DEFINE_STATIC_CALL(elevator_issue, elevator_issue_enosys);
+DEFINE_STATIC_CALL(elevator_stop, elevator_stop_enosys);
+DEFINE_STATIC_CALL(elevator_eta, elevator_eta_enosys);
+
+DEFINE_STATIC_SRCU(elevator_srcu);
+static DEFINE_MUTEX(elevator_register_mutex);
+static bool elevator_registered;
+
+int elevator_syscalls_register(int (*start)(void), int (*issue)(int,int,int), int (*stop)(void),
+                               int (*eta)(struct elevator_eta __user *)) {
+  mutex_lock(&elevator_register_mutex);
+  if(elevator_registered) {
+    mutex_unlock(&elevator_register_mutex);
+    return -EBUSY;
+  }
+
+  static_call_update(elevator_start, start);
+  static_call_update(elevator_issue, issue);
+  static_call_update(elevator_stop, stop);
+  static_call_update(elevator_eta, eta);
+  elevator_registered = true;
+  mutex_unlock(&elevator_register_mutex);
+  return 0;
+}
+
+void elevator_syscalls_unregister(void) {
+  mutex_lock(&elevator_register_mutex);
+  static_call_update(elevator_start, elevator_start_enosys);
+  static_call_update(elevator_issue, elevator_issue_enosys);
+  static_call_update(elevator_stop, elevator_stop_enosys);
+  static_call_update(elevator_eta, elevator_eta_enosys);
+  elevator_registered = false;
+  mutex_unlock(&elevator_register_mutex);
+
+  // New calls now hit the -ENOSYS stubs, wait out the ones still in the module
+  synchronize_srcu(&elevator_srcu);
+}
+
+// GPL exports, so the module can find them at load time with symbol_get()
+EXPORT_SYMBOL_GPL(elevator_syscalls_register);
+EXPORT_SYMBOL_GPL(elevator_syscalls_unregister);
 
 SYSCALL_DEFINE0(start_elevator) {
-  printk(KERN_NOTICE "Inside SYSCALL_DEFINE0 block. %s", __FUNCTION__);
-  if(STUB_start_elevator != NULL)
-    return STUB_start_elevator();
-  else
-    return -ENOSYS;
+  int idx = srcu_read_lock(&elevator_srcu);
+  int ret = static_call(elevator_start)();
+
+  srcu_read_unlock(&elevator_srcu, idx);
+  return ret;
 }
 
 SYSCALL_DEFINE0(stop_elevator) {
-  printk(KERN_NOTICE "Inside SYSCALL_DEFINE0 block. %s", __FUNCTION__);
-  if(STUB_stop_elevator != NULL)
-    return STUB_stop_elevator();
-  else
-    return -ENOSYS;
+  int idx = srcu_read_lock(&elevator_srcu);
+  int ret = static_call(elevator_stop)();
+
+  srcu_read_unlock(&elevator_srcu, idx);
+  return ret;
 }
 
 SYSCALL_DEFINE3(issue_request, int, start_floor, int, destination_floor, int, type) {
-  printk(KERN_NOTICE "Inside SYSCALL_DEFINE2 block. %s: Your int are %d, %d, %d\n", __FUNCTION__, start_floor, destination_floor, type);
-  if(STUB_issue_request != NULL)
-    return STUB_issue_request(start_floor, destination_floor, type);
-  else
-    return -ENOSYS;
+  int idx = srcu_read_lock(&elevator_srcu);
+  int ret = static_call(elevator_issue)(start_floor, destination_floor, type);
+
+  srcu_read_unlock(&elevator_srcu, idx);
+  return ret;
+}
+
+// Predicted wait and ride for a request, see struct elevator_eta in the elevator module
+SYSCALL_DEFINE1(elevator_eta, struct elevator_eta __user *, eta) {
+  int idx = srcu_read_lock(&elevator_srcu);
+  int ret = static_call(elevator_eta)(eta);
+
+  srcu_read_unlock(&elevator_srcu, idx);
+  return ret;
 }
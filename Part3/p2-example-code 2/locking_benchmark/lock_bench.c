@@ -0,0 +1,420 @@
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/kthread.h>
+#include <linux/delay.h>
+#include <linux/sched.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/seqlock.h>
+#include <linux/atomic.h>
+#include <linux/percpu.h>
+#include <linux/cpumask.h>
+#include <linux/ktime.h>
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Scaling of counter increments under different locking primitives");
+
+/*
+ * The threading_and_locking example, turned into a benchmark: N kthreads
+ * spread over the online CPUs increment shared counters as fast as they
+ * can, through one primitive at a time, for 1, 2, 4, ... up to max_threads
+ * threads. Each op touches cs_len counters, like the example's loop over
+ * cnt[]. Writing anything to /proc/lock_bench runs the sweep; reading it
+ * shows ops/sec, ns/op and, since every counter must end up equal to the
+ * number of ops, how many increments were lost.
+ *
+ * seqlock-write only takes the write side. seqlock-read measures readers:
+ * with N threads, one writes as in seqlock-write and N-1 read all cs_len
+ * counters under read_seqbegin/read_seqretry (a single thread just reads).
+ * Its ops are reads, retries counts read sections that had to be redone,
+ * and lost counts reads that saw the counters disagree (only possible to
+ * notice with cs_len > 1), which must be 0.
+ */
+
+#define ENTRY_NAME "lock_bench"
+#define PERMS 0644
+#define PARENT NULL
+
+#define CNT_SIZE 20
+#define MAX_COUNTS 16
+
+static unsigned int duration_ms = 500;
+module_param(duration_ms, uint, 0644);
+MODULE_PARM_DESC(duration_ms, "Run time of each primitive/thread count pair in ms");
+
+static unsigned int cs_len = 1;
+module_param(cs_len, uint, 0644);
+MODULE_PARM_DESC(cs_len, "Counters incremented per op, 1-20");
+
+static unsigned int max_threads;
+module_param(max_threads, uint, 0644);
+MODULE_PARM_DESC(max_threads, "Largest thread count (0 = number of online CPUs)");
+
+enum primitive {
+	P_NONE, P_MUTEX, P_SPINLOCK, P_ATOMIC, P_PERCPU, P_SEQLOCK_WRITE, P_SEQLOCK_READ, NUM_PRIMITIVES
+};
+
+static const char *primitive_names[NUM_PRIMITIVES] = {
+	"unprotected", "mutex", "spinlock", "atomic", "percpu", "seqlock-write", "seqlock-read",
+};
+
+/******************************************************************************/
+
+// Locks and counters are packed together as they would be in real code, so
+// the counters sit on the same few cache lines as the locks guarding them.
+static struct {
+	struct mutex mutex;
+	spinlock_t spinlock;
+	seqlock_t seqlock;
+	unsigned long cnt[CNT_SIZE];
+	atomic_long_t atomic_cnt[CNT_SIZE];
+} shared ____cacheline_aligned_in_smp;
+
+static unsigned long __percpu *percpu_cnt;
+
+struct bench_thread {
+	struct task_struct *kthread;
+	bool reader;
+	unsigned long ops;
+	unsigned long retries;
+	unsigned long torn;
+} ____cacheline_aligned_in_smp;
+
+static struct {
+	enum primitive prim;
+	unsigned int len;
+	atomic_t ready;
+	bool go;
+	bool stop;
+} run;
+
+struct result {
+	unsigned int threads;
+	u64 ops;
+	u64 elapsed_ns;
+	u64 lost;
+	u64 retries;
+};
+
+static struct result results[NUM_PRIMITIVES][MAX_COUNTS];
+static int num_counts;
+static bool have_results;
+
+static DEFINE_MUTEX(bench_lock);
+
+/******************************************************************************/
+
+static void do_op(enum primitive prim, unsigned int len) {
+	unsigned int i;
+
+	switch (prim) {
+	case P_NONE:
+		// Deliberately racy: read-modify-write with no exclusion.
+		for (i = 0; i < len; i++)
+			WRITE_ONCE(shared.cnt[i], READ_ONCE(shared.cnt[i]) + 1);
+		break;
+	case P_MUTEX:
+		mutex_lock(&shared.mutex);
+		for (i = 0; i < len; i++)
+			shared.cnt[i]++;
+		mutex_unlock(&shared.mutex);
+		break;
+	case P_SPINLOCK:
+		spin_lock(&shared.spinlock);
+		for (i = 0; i < len; i++)
+			shared.cnt[i]++;
+		spin_unlock(&shared.spinlock);
+		break;
+	case P_ATOMIC:
+		for (i = 0; i < len; i++)
+			atomic_long_inc(&shared.atomic_cnt[i]);
+		break;
+	case P_PERCPU:
+		for (i = 0; i < len; i++)
+			this_cpu_inc(percpu_cnt[i]);
+		break;
+	case P_SEQLOCK_WRITE:
+	case P_SEQLOCK_READ:
+		write_seqlock(&shared.seqlock);
+		for (i = 0; i < len; i++)
+			shared.cnt[i]++;
+		write_sequnlock(&shared.seqlock);
+		break;
+	default:
+		break;
+	}
+}
+
+// One consistent read of the counters a seqlock writer bumps together.
+static void do_read(struct bench_thread *t, unsigned int len) {
+	unsigned long first;
+	unsigned int seq, i;
+	bool torn;
+
+	for (;;) {
+		seq = read_seqbegin(&shared.seqlock);
+		first = READ_ONCE(shared.cnt[0]);
+		torn = false;
+		for (i = 1; i < len; i++)
+			if (READ_ONCE(shared.cnt[i]) != first)
+				torn = true;
+		if (!read_seqretry(&shared.seqlock, seq))
+			break;
+		t->retries++;
+	}
+	t->torn += torn;
+}
+
+static int thread_run(void *data) {
+	struct bench_thread *t = data;
+	enum primitive prim = run.prim;
+	unsigned int len = run.len;
+	unsigned long ops = 0;
+
+	atomic_inc(&run.ready);
+	// More threads than CPUs share a CPU, so yield while waiting.
+	while (!READ_ONCE(run.go))
+		cond_resched();
+
+	while (!READ_ONCE(run.stop)) {
+		if (t->reader)
+			do_read(t, len);
+		else
+			do_op(prim, len);
+		// Give the scheduler a chance on non-preemptible kernels.
+		if ((++ops & 1023) == 0)
+			cond_resched();
+	}
+	t->ops = ops;
+
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!kthread_should_stop())
+			schedule();
+		__set_current_state(TASK_RUNNING);
+	}
+	return 0;
+}
+
+/******************************************************************************/
+
+static void reset_counters(void) {
+	int i, cpu;
+
+	for (i = 0; i < CNT_SIZE; i++) {
+		shared.cnt[i] = 0;
+		atomic_long_set(&shared.atomic_cnt[i], 0);
+	}
+	for_each_possible_cpu(cpu)
+		for (i = 0; i < CNT_SIZE; i++)
+			per_cpu_ptr(percpu_cnt, cpu)[i] = 0;
+}
+
+// What counter 0 ended at; every op adds exactly one to it.
+static u64 counter_total(enum primitive prim) {
+	u64 total = 0;
+	int cpu;
+
+	switch (prim) {
+	case P_ATOMIC:
+		return atomic_long_read(&shared.atomic_cnt[0]);
+	case P_PERCPU:
+		for_each_possible_cpu(cpu)
+			total += per_cpu_ptr(percpu_cnt, cpu)[0];
+		return total;
+	default:
+		return shared.cnt[0];
+	}
+}
+
+static int run_one(enum primitive prim, unsigned int nthreads, const int *cpus, int ncpus, struct result *res) {
+	struct bench_thread *threads;
+	u64 start, ops = 0, writes = 0, retries = 0, torn = 0, total;
+	int i, ret = 0;
+
+	threads = kcalloc(nthreads, sizeof(*threads), GFP_KERNEL);
+	if (threads == NULL)
+		return -ENOMEM;
+
+	reset_counters();
+	run.prim = prim;
+	run.len = cs_len;
+	atomic_set(&run.ready, 0);
+	WRITE_ONCE(run.go, false);
+	WRITE_ONCE(run.stop, false);
+
+	for (i = 0; i < nthreads; i++) {
+		// seqlock-read: thread 0 writes unless it is alone, the rest read.
+		threads[i].reader = prim == P_SEQLOCK_READ && (i > 0 || nthreads == 1);
+		threads[i].kthread = kthread_create(thread_run, &threads[i], "lock_bench/%d", i);
+		if (IS_ERR(threads[i].kthread)) {
+			ret = PTR_ERR(threads[i].kthread);
+			threads[i].kthread = NULL;
+			break;
+		}
+		kthread_bind(threads[i].kthread, cpus[i % ncpus]);
+		wake_up_process(threads[i].kthread);
+	}
+
+	if (ret == 0) {
+		while (atomic_read(&run.ready) < nthreads)
+			msleep(1);
+		start = ktime_get_ns();
+		WRITE_ONCE(run.go, true);
+		msleep(duration_ms);
+		WRITE_ONCE(run.stop, true);
+		res->elapsed_ns = ktime_get_ns() - start;
+	}
+
+	// Start the stop before joining, so nobody keeps counting while we
+	// wait for the others.
+	WRITE_ONCE(run.stop, true);
+	WRITE_ONCE(run.go, true);
+	for (i = 0; i < nthreads; i++) {
+		if (threads[i].kthread == NULL)
+			continue;
+		kthread_stop(threads[i].kthread);
+		if (threads[i].reader) {
+			ops += threads[i].ops;
+			retries += threads[i].retries;
+			torn += threads[i].torn;
+		} else {
+			writes += threads[i].ops;
+		}
+	}
+	kfree(threads);
+
+	if (ret)
+		return ret;
+
+	total = counter_total(prim);
+	res->threads = nthreads;
+	res->retries = retries;
+	if (prim == P_SEQLOCK_READ) {
+		res->ops = ops;
+		res->lost = torn;
+	} else {
+		res->ops = writes;
+		res->lost = writes > total ? writes - total : 0;
+	}
+	return 0;
+}
+
+static int run_all(void) {
+	unsigned int counts[MAX_COUNTS], limit, n;
+	int *cpus, ncpus = 0, cpu, p, c, nc = 0, ret = 0;
+
+	limit = max_threads ? max_threads : num_online_cpus();
+	for (n = 1; n < limit && nc < MAX_COUNTS - 1; n *= 2)
+		counts[nc++] = n;
+	counts[nc++] = limit;
+
+	cpus = kcalloc(nr_cpu_ids, sizeof(*cpus), GFP_KERNEL);
+	if (cpus == NULL)
+		return -ENOMEM;
+	for_each_online_cpu(cpu)
+		cpus[ncpus++] = cpu;
+
+	have_results = false;
+	for (p = 0; p < NUM_PRIMITIVES && ret == 0; p++)
+		for (c = 0; c < nc && ret == 0; c++)
+			ret = run_one(p, counts[c], cpus, ncpus, &results[p][c]);
+	num_counts = nc;
+	have_results = ret == 0;
+
+	kfree(cpus);
+	return ret;
+}
+
+/******************************************************************************/
+
+// Threads whose ops are reported: seqlock-read leaves out its writer.
+static unsigned int op_threads(enum primitive prim, unsigned int nthreads) {
+	return prim == P_SEQLOCK_READ && nthreads > 1 ? nthreads - 1 : nthreads;
+}
+
+static int lock_bench_show(struct seq_file *m, void *v) {
+	struct result *r;
+	int p, c;
+
+	mutex_lock(&bench_lock);
+	if (!have_results) {
+		seq_printf(m, "no results, run with: echo 1 > /proc/%s\n", ENTRY_NAME);
+		goto out;
+	}
+
+	seq_printf(m, "%u ms per run, %u counters per op\n", duration_ms, cs_len);
+	seq_printf(m, "%-14s %7s %14s %10s %12s %12s\n", "primitive", "threads", "ops/sec", "ns/op", "lost",
+		   "retries");
+	for (p = 0; p < NUM_PRIMITIVES; p++) {
+		for (c = 0; c < num_counts; c++) {
+			r = &results[p][c];
+			// ns/op is per thread: how long one op takes its caller.
+			seq_printf(m, "%-14s %7u %14llu %10llu %12llu %12llu\n", primitive_names[p], r->threads,
+				   r->elapsed_ns ? div64_u64(r->ops * NSEC_PER_SEC, r->elapsed_ns) : 0,
+				   r->ops ? div64_u64(r->elapsed_ns * op_threads(p, r->threads), r->ops) : 0,
+				   r->lost, r->retries);
+		}
+	}
+out:
+	mutex_unlock(&bench_lock);
+	return 0;
+}
+
+static int lock_bench_open(struct inode *inode, struct file *file) {
+	return single_open(file, lock_bench_show, NULL);
+}
+
+static ssize_t lock_bench_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos) {
+	int ret;
+
+	if (cs_len < 1 || cs_len > CNT_SIZE)
+		return -EINVAL;
+	if (!mutex_trylock(&bench_lock))
+		return -EBUSY;
+	ret = run_all();
+	mutex_unlock(&bench_lock);
+
+	return ret ? ret : count;
+}
+
+static const struct proc_ops fops = {
+	.proc_open = lock_bench_open,
+	.proc_read = seq_read,
+	.proc_write = lock_bench_write,
+	.proc_lseek = seq_lseek,
+	.proc_release = single_release,
+};
+
+/******************************************************************************/
+
+static int lock_bench_init(void) {
+	mutex_init(&shared.mutex);
+	spin_lock_init(&shared.spinlock);
+	seqlock_init(&shared.seqlock);
+
+	percpu_cnt = __alloc_percpu(sizeof(unsigned long) * CNT_SIZE, __alignof__(unsigned long));
+	if (percpu_cnt == NULL)
+		return -ENOMEM;
+
+	if (!proc_create(ENTRY_NAME, PERMS, PARENT, &fops)) {
+		printk(KERN_WARNING "lock_bench_init");
+		free_percpu(percpu_cnt);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+module_init(lock_bench_init);
+
+static void lock_bench_exit(void) {
+	remove_proc_entry(ENTRY_NAME, PARENT);
+	free_percpu(percpu_cnt);
+	mutex_destroy(&shared.mutex);
+	printk(KERN_NOTICE "Removing /proc/%s\n", ENTRY_NAME);
+}
+module_exit(lock_bench_exit);